@@ -1,18 +1,41 @@
 #include <RF24.h>
+#include <EEPROM.h>
 #include <string.h>
+#include <ctype.h>
 #include "Nightlight.h"
+#include "NightlightTables.h"
 
-Nightlight::Nightlight(uint64_t broadcast) : _radio(9,10)
+NightlightLink::NightlightLink(uint64_t broadcast) : _radio(9,10)
 {
   _broadcast = broadcast;
+  _myAddressOffset = 0;
+  _queueLength = 0;
+  _rejected = 0;
+  _lastRefill = 0;
+  _channel = CHANNEL_RENDEZVOUS;
+  _numLinks = 0;
+  _linkAdaptation = true;
+
+  memset(_traffic, 0, sizeof(_traffic));
+  setBudget(PRIORITY_COMMAND, 2000, 1000);
+  setBudget(PRIORITY_CONTROL, 500, 250);
+  setBudget(PRIORITY_PRESENCE, 200, 100);
+  setBudget(PRIORITY_TELEMETRY, 200, 100);
+}
+
+Nightlight::Nightlight(uint64_t broadcast) : NightlightLink(broadcast)
+{
   _numStates = 0;
 }
 
-void Nightlight::setup()
+void NightlightLink::setup()
 {
   
-  randomSeed(analogRead(3));
-  _myAddressOffset = random(256);
+  // Pick a random address, 1-255, unless one has been set
+  if(!_myAddressOffset) {
+    randomSeed(analogRead(3));
+    _myAddressOffset = 1 + random(255);
+  }
   Serial.print("\n00 My address is ");
   Serial.println(_myAddressOffset);
 
@@ -25,6 +48,7 @@ void Nightlight::setup()
 
   _radio.setDataRate(RF24_2MBPS);
   _radio.setPALevel(RF24_PA_HIGH);
+  _radio.setChannel(_channel);
 
   // Listen on the broadcast port
   _radio.openReadingPipe(0, _broadcast);
@@ -34,7 +58,7 @@ void Nightlight::setup()
   _radio.startListening();
 }
 
-void Nightlight::enableSerial() {
+void NightlightLink::enableSerial() {
   Serial.begin(57600, SERIAL_8N1);
   Serial.println("00 Nightlight - serial communication activated");
   Serial.print("00 Listening on ");
@@ -46,15 +70,20 @@ void Nightlight::enableSerial() {
 
 void Nightlight::loop()
 {
+  NightlightMessage message;
+
   // Check for radio messages
-  if ( _radio.available() ) {
-    _handleRadioInput();
+  if(readRadio(&message)) {
+    _dispatch(message.sender, message.type, message.data, message.dataLength);
   }
 
   // Check for serial messages
-  if ( Serial.available() ) {
-    _handleSerialInput();
+  if(readSerial(&message)) {
+    _dispatch(message.sender, message.type, message.data, message.dataLength);
   }
+
+  // Send deferred radio frames that are now within budget
+  transmitQueued();
   
   // Check for timeouts
   int i;
@@ -67,42 +96,106 @@ void Nightlight::loop()
   }
 }
 
-void Nightlight::_handleRadioInput() {
-  byte message[32];
+/**
+ * Msec until loop() next has timed work to do, i.e. a state timeout or deferred
+ * frames waiting for budget; NO_TIMEOUT if there is none.
+ * Lets an event loop sleep instead of calling loop() continuously.
+ */
+unsigned long Nightlight::nextTimeout()
+{
+  int i;
+  unsigned long m = millis();
+  unsigned long next = NO_TIMEOUT;
 
-  // Fetch the payload, and see if this was the last one.
-  byte messageSize = _radio.getDynamicPayloadSize();
+  for(i=0; i<_numStates; i++) {
+    if(!_states[i]->_timeout) continue;
 
-  _radio.read(message, 32);
+    // Timeouts fire once millis() has passed them
+    if(_states[i]->_timeout < m) return 0;
+    if(_states[i]->_timeout - m + 1 < next) next = _states[i]->_timeout - m + 1;
+  }
 
-  // Debug message receive
-  SEND_DEBUG_MESSAGE("Message received from ", message[1], _myAddressOffset, message[0], messageSize-2, message+2);
+  if(queuedFrames() && BUDGET_REFILL_PERIOD < next) next = BUDGET_REFILL_PERIOD;
 
-  // Bubble message through states until one receives the inout
+  return next;
+}
+
+/**
+ * Bubble a message through states, top of the stack first, until one receives it
+ */
+void Nightlight::_dispatch(int sender, byte type, byte *data, byte dataLength)
+{
   int i;
   for(i=_numStates-1;i>=0;i--) {
-    if(_states[i]->receiveMessage(this, message[1], message[0], message+2, messageSize-2)) break;
+    if(_states[i]->receiveMessage(this, sender, type, data, dataLength)) break;
+  }
+}
+
+/**
+ * Read a pending radio message, if there is one
+ */
+bool NightlightLink::readRadio(NightlightMessage *message) {
+  if(!_radio.available()) return false;
+
+  byte *packet = (byte *)message->buffer;
+
+  // Fetch the payload, and see if this was the last one.
+  byte messageSize = _radio.getDynamicPayloadSize();
+
+  _radio.read(packet, 32);
+
+  // Drop malformed frames here, so that states can trust dataLength and the
+  // message's schema
+  MessageHeader *header = (MessageHeader *)packet;
+  if(messageSize < MESSAGE_HEADER_LENGTH || messageSize > 32
+      || header->dataLength > messageSize - MESSAGE_HEADER_LENGTH) {
+    _rejected++;
+    return false;
   }
+
+  message->type = header->type;
+  message->sender = header->sender;
+  message->data = packet + MESSAGE_HEADER_LENGTH;
+  message->dataLength = header->dataLength;
+  if(!messageComplete(message->type, message->data, &message->dataLength)) {
+    _rejected++;
+    return false;
+  }
+
+  // Debug message receive
+  SEND_DEBUG_MESSAGE("Message received from ", message->sender, _myAddressOffset, message->type, message->dataLength, message->data);
+
+  return true;
 }
 
-void Nightlight::_handleSerialInput() {
-  char c[80];
+/**
+ * Read a pending serial message, if there is one
+ *
+ * Serial lines are text: the type as a hex pair, then the data as the host
+ * typed it, e.g. hex pairs for MSG_COMMAND_SEND or a name for MSG_CHANGE_MODE.
+ * They don't have the binary layout of NightlightMessages.h, so aren't checked
+ * against its schema; states that take serial input (sender -1) parse the text
+ * themselves.
+ */
+bool NightlightLink::readSerial(NightlightMessage *message) {
+  if(!Serial.available()) return false;
+
+  char *c = message->buffer;
   byte numChars;
 
   // Collect a line from the serial device (of up to 80 char)
-  numChars = Serial.readBytesUntil('\n', c, 80);
+  numChars = Serial.readBytesUntil('\n', c, 79);
   c[numChars] = 0;
 
-  byte type = hexPair(c);
+  message->type = hexPair(c);
+  message->sender = -1;
+  message->data = (byte *)c+3;
+  message->dataLength = numChars > 3 ? numChars-3 : 0;
 
   // Debug message receive
-  SEND_DEBUG_MESSAGE("Message received from ", -1, _myAddressOffset, type, numChars, (byte *)c);
+  SEND_DEBUG_MESSAGE("Message received from ", -1, _myAddressOffset, message->type, numChars, (byte *)c);
 
-  // Bubble message through states until one receives the input
-  int i;
-  for(i=_numStates-1;i>=0;i--) {
-    if(_states[i]->receiveMessage(this, -1, type, (byte *)c+3, numChars-3)) break;
-  }
+  return true;
 }
 
 
@@ -117,22 +210,48 @@ void Nightlight::_handleSerialInput() {
  */
 void Nightlight::sendMessage(int address, byte type, byte *data, byte dataLength)
 {
-
-  int i;
-  byte packet[32];
-
   SEND_DEBUG_MESSAGE("Sending message to ", address, _myAddressOffset, type, dataLength, data);
 
-  // Internal message to send back to other states
+  // Internal message to send back to other states, checked like a radio frame
   if(address == _myAddressOffset) {
-    // Bubble message through states until one receives the inout
-    for(i=_numStates-1;i>=0;i--) {
-      if(_states[i]->receiveMessage(this, _myAddressOffset, type, data, dataLength)) break;
+    if(dataLength < messageLength(type)) {
+      byte complete[MESSAGE_MAX_DATA];
+      memcpy(complete, data, dataLength);
+      if(messageComplete(type, complete, &dataLength)) _dispatch(_myAddressOffset, type, complete, dataLength);
+    } else {
+      _dispatch(_myAddressOffset, type, data, dataLength);
     }
+
+  } else {
+    transmit(address, type, data, dataLength);
   }
+}
+
+/**
+ * Send a message only if it can go out straight away; it is never deferred.
+ * Returns whether it was sent, so that the caller can try again later.
+ *
+ * @param address 0 for broadcast, 1-255 for a specific recipient, -1 for serial
+ */
+bool Nightlight::sendNow(int address, byte type, byte *data, byte dataLength)
+{
+  if(address != _myAddressOffset && !canTransmit(address, type, dataLength)) return false;
+
+  sendMessage(address, type, data, dataLength);
+  return true;
+}
+
+/**
+ * Send a message over serial or radio, never back to this node's states
+ *
+ * @param address 0 for broadcast, 1-255 for a specific recipient, -1 for serial
+ */
+void NightlightLink::transmit(int address, byte type, byte *data, byte dataLength)
+{
+  byte packet[32];
 
   // Serial message
-  else if(address == -1) {
+  if(address == -1) {
     Serial.print(type, HEX);
     Serial.print(' ');
     Serial.println((char *)data);
@@ -141,23 +260,344 @@ void Nightlight::sendMessage(int address, byte type, byte *data, byte dataLength
 
   // Radio message
   else {
-    _radio.stopListening();
-    _radio.openWritingPipe(_broadcast + address);
+    if(dataLength > MESSAGE_MAX_DATA) return;
 
     // Build packet
-    packet[0] = type;
-    packet[1] = _myAddressOffset;
+    MessageHeader *header = (MessageHeader *)packet;
+    header->type = type;
+    header->sender = _myAddressOffset;
+    header->dataLength = dataLength;
     for(int i=0;i<dataLength;i++) {
-      packet[i+2] = data[i];
+      packet[i+MESSAGE_HEADER_LENGTH] = data[i];
+    }
+
+    byte priority = messagePriority(type);
+    byte length = dataLength + MESSAGE_HEADER_LENGTH;
+
+    // Commands always go out; when over budget they take airtime from lower classes
+    if(priority == PRIORITY_COMMAND) {
+      byte i;
+      unsigned int cost = frameCost(length);
+      _refill();
+      for(i=PRIORITY_COMMAND; i<PRIORITY_CLASSES && cost; i++) {
+        unsigned int take = _traffic[i].tokens < cost ? _traffic[i].tokens : cost;
+        _traffic[i].tokens -= take;
+        cost -= take;
+      }
+      _traffic[PRIORITY_COMMAND].sent++;
+      _write(address, _channel, packet, length);
+
+    // Each class spends its own budget, but doesn't overtake its own deferred frames
+    } else if(!_queued(priority) && _spend(priority, frameCost(length))) {
+      _traffic[priority].sent++;
+      _write(address, _channel, packet, length);
+
+    // Stale presence beacons are worth nothing
+    } else if(priority == PRIORITY_PRESENCE) {
+      _traffic[priority].dropped++;
+
+    } else {
+      _defer(address, priority, packet, length);
+    }
+  }
+}
+
+/**
+ * Whether transmit() would send a message straight away: within its class's
+ * budget and behind none of the class's deferred frames
+ *
+ * @param address 0 for broadcast, 1-255 for a specific recipient, -1 for serial
+ */
+bool NightlightLink::canTransmit(int address, byte type, byte dataLength)
+{
+  if(address == -1) return true;
+  if(dataLength > MESSAGE_MAX_DATA) return false;
+
+  byte priority = messagePriority(type);
+  if(priority == PRIORITY_COMMAND) return true;
+
+  _refill();
+  return !_queued(priority) &&
+    _traffic[priority].tokens >= frameCost(dataLength + MESSAGE_HEADER_LENGTH);
+}
+
+/**
+ * Send deferred frames, highest priority first, while there is budget for them.
+ * A class that is out of budget waits without holding up the others.
+ */
+void NightlightLink::transmitQueued()
+{
+  byte i, j, priority;
+
+  for(priority=0; priority<PRIORITY_CLASSES; priority++) {
+    i = 0;
+    while(i < _queueLength) {
+      QueuedFrame *frame = _queue + i;
+      if(frame->priority != priority) {
+        i++;
+        continue;
+      }
+
+      // Later frames of this class wait too, so that they stay in order
+      if(!_spend(priority, frameCost(frame->length))) break;
+
+      _traffic[priority].sent++;
+      _write(frame->address, frame->channel, frame->packet, frame->length);
+
+      // Keep the queue in arrival order
+      _queueLength--;
+      for(j=i; j<_queueLength; j++) {
+        _queue[j] = _queue[j+1];
+      }
+    }
+  }
+}
+
+/**
+ * Whether any frames of a priority class are waiting for budget
+ */
+bool NightlightLink::_queued(byte priority)
+{
+  byte i;
+  for(i=0; i<_queueLength; i++) {
+    if(_queue[i].priority == priority) return true;
+  }
+  return false;
+}
+
+/**
+ * The number of frames waiting for budget
+ */
+byte NightlightLink::queuedFrames()
+{
+  return _queueLength;
+}
+
+/**
+ * Queue a frame until there is budget for it.
+ * If the queue is full, the lowest priority frame (newest first) is dropped.
+ */
+void NightlightLink::_defer(int address, byte priority, byte *packet, byte length)
+{
+  byte i;
+
+  if(_queueLength >= SEND_QUEUE_SIZE) {
+    byte worst = _queueLength - 1;
+    for(i=worst; i>0; i--) {
+      if(_queue[i-1].priority > _queue[worst].priority) worst = i-1;
+    }
+
+    // Nothing less important than this frame to make room
+    if(_queue[worst].priority <= priority) {
+      _traffic[priority].dropped++;
+      return;
+    }
+
+    _traffic[_queue[worst].priority].dropped++;
+    _queueLength--;
+    for(i=worst; i<_queueLength; i++) {
+      _queue[i] = _queue[i+1];
+    }
+  }
+
+  QueuedFrame *frame = _queue + _queueLength;
+  frame->address = address;
+  frame->channel = _channel;
+  frame->priority = priority;
+  frame->length = length;
+  memcpy(frame->packet, packet, length);
+  _queueLength++;
+
+  _traffic[priority].deferred++;
+}
+
+/**
+ * Write a frame to the radio, on the channel that was current when it was sent.
+ * Retries and transmit power are chosen from the link statistics of the recipient.
+ */
+void NightlightLink::_write(int address, byte channel, byte *packet, byte length)
+{
+  LinkStats *link = 0;
+  byte retries = LINK_MAX_RETRIES;
+  byte delay = 15;
+  byte power = RF24_PA_HIGH;
+
+  _radio.stopListening();
+  if(channel != _channel) _radio.setChannel(channel);
+  _radio.openWritingPipe(_broadcast + address);
+
+  // Nobody acknowledges a broadcast, so retrying only wastes airtime
+  if(_linkAdaptation && address == 0) {
+    retries = 0;
+    delay = 0;
+
+  } else if(_linkAdaptation) {
+    link = _link(address);
+
+    // Allow twice the usual number of retries, unless the link is mostly failing anyway
+    retries = (link->retries >> 3) + LINK_MIN_RETRIES;
+    if(retries > LINK_MAX_RETRIES) retries = LINK_MAX_RETRIES;
+    if(link->successRatio < LINK_POOR) retries = LINK_MIN_RETRIES;
+
+    // Back off for longer between retries when the channel is busy
+    delay = link->busy > link->failed / 2 ? 3 : 1;
+
+    if(link->successRatio > LINK_GOOD && link->retries < 8) power = RF24_PA_LOW;
+  }
+
+  _radio.setRetries(delay, retries);
+  _radio.setPALevel(power);
+
+  bool acknowledged = _radio.write(packet, length);
+
+  if(link) {
+    retries = _radio.retriesLastFrame();
+
+    link->sent++;
+    // Moving averages, weighting the latest frame by 1/8
+    link->successRatio = (link->successRatio * 7 + (acknowledged ? 255 : 0)) >> 3;
+    link->retries = (link->retries * 7 + (retries << 4)) >> 3;
+    if(!acknowledged) {
+      link->failed++;
+      if(_radio.testCarrier()) link->busy++;
     }
+  }
+
+  if(channel != _channel) _radio.setChannel(_channel);
+  _radio.startListening();
+}
+
+/**
+ * The link statistics for a peer, replacing the least recently used peer if it's new
+ */
+LinkStats *NightlightLink::_link(byte address)
+{
+  byte i;
+  LinkStats link;
+
+  for(i=0; i<_numLinks; i++) {
+    if(_links[i].address == address) break;
+  }
+
+  if(i < _numLinks) {
+    link = _links[i];
+  } else {
+    // Optimistic start: a new peer gets the benefit of the doubt
+    memset(&link, 0, sizeof(link));
+    link.address = address;
+    link.successRatio = 255;
+    link.retries = 1 << 4;
+
+    if(_numLinks < LINK_TABLE_SIZE) _numLinks++;
+    i = _numLinks - 1;
+  }
+
+  // Move to the front, so the least recently used peer is last
+  for(; i>0; i--) {
+    _links[i] = _links[i-1];
+  }
+  _links[0] = link;
+  return _links;
+}
+
+/**
+ * Link statistics for a peer, or 0 if nothing has been sent to it recently
+ */
+const LinkStats *NightlightLink::linkStats(byte address)
+{
+  byte i;
+  for(i=0; i<_numLinks; i++) {
+    if(_links[i].address == address) return _links + i;
+  }
+  return 0;
+}
+
+/**
+ * Turn per-peer retries and power on or off; when off, every frame gets 15 retries
+ * at 4 msec intervals, as before
+ */
+void NightlightLink::setLinkAdaptation(bool enable)
+{
+  _linkAdaptation = enable;
+}
+
+/**
+ * Move to another radio channel.
+ * Frames already deferred by the airtime budget still go out on their original channel.
+ */
+void NightlightLink::setChannel(byte channel)
+{
+  if(channel == _channel) return;
+  _channel = channel;
+
+  _radio.stopListening();
+  _radio.setChannel(channel);
+  _radio.startListening();
+}
+
+byte NightlightLink::channel()
+{
+  return _channel;
+}
+
+/**
+ * Take airtime from a class's budget, if there is enough
+ */
+bool NightlightLink::_spend(byte priority, unsigned int cost)
+{
+  _refill();
+  if(_traffic[priority].tokens < cost) return false;
+  _traffic[priority].tokens -= cost;
+  return true;
+}
+
+/**
+ * Top up every class's budget for the time since the last refill
+ */
+void NightlightLink::_refill()
+{
+  unsigned long m = millis();
+  unsigned long elapsed = m - _lastRefill;
+  byte i;
 
-    // Non-blocking, no error checking
-    _radio.write(packet, dataLength + 2 );
+  // Refill in steps, so that rounding loses little budget
+  if(elapsed < BUDGET_REFILL_PERIOD) return;
+  _lastRefill = m;
 
-    _radio.startListening();
+  for(i=0; i<PRIORITY_CLASSES; i++) {
+    unsigned long tokens = _traffic[i].tokens + elapsed * _traffic[i].rate / 1000;
+    _traffic[i].tokens = tokens > _traffic[i].burst ? _traffic[i].burst : tokens;
   }
 }
 
+/**
+ * Set the airtime budget of a priority class, in bytes per second and burst bytes.
+ * Each frame costs frameCost() of its length, i.e. plus RADIO_FRAME_OVERHEAD.
+ */
+void NightlightLink::setBudget(byte priority, unsigned int rate, unsigned int burst)
+{
+  _traffic[priority].rate = rate;
+  _traffic[priority].burst = burst;
+  _traffic[priority].tokens = burst;
+}
+
+/**
+ * Budget and sent/deferred/dropped counters for a priority class
+ */
+const TrafficClass *NightlightLink::trafficStats(byte priority)
+{
+  _refill();
+  return _traffic + priority;
+}
+
+/**
+ * Number of radio frames dropped because they didn't match the message schema
+ */
+unsigned long NightlightLink::rejectedFrames()
+{
+  return _rejected;
+}
+
 /**
  * Switch from one state to another
  */
@@ -177,6 +617,9 @@ void Nightlight::removeState(NightlightState *state)
   for(i=0; i<_numStates; i++) {
     if(_states[i] == state) break;
   }
+  // Not on the stack
+  if(i == _numStates) return;
+
   // Shift all other items back 1
   for(; i<_numStates-1;i++) {
     _states[i] = _states[i+1];
@@ -189,6 +632,9 @@ void Nightlight::removeState(NightlightState *state)
  */
 void Nightlight::pushState(NightlightState *state)
 {
+  // No room; states must be removed before others are pushed
+  if(_numStates >= STATE_STACK_SIZE) return;
+
   // Add the item to the stack
   _states[_numStates] = state;
   _numStates++;
@@ -197,8 +643,22 @@ void Nightlight::pushState(NightlightState *state)
   state->start(this);
 }
 
+/**
+ * Number of states on the stack
+ */
+byte Nightlight::numStates()
+{
+  return _numStates;
+}
+
 ///////////////////////////////////////////////////////
 
+NightlightState::NightlightState()
+{
+  _timeout = 0;
+  _notifyFinished = 0;
+}
+
 void NightlightState::setTimeout(unsigned long timeout)
 {
   _timeout = millis() + timeout;
@@ -229,6 +689,8 @@ void NightlightState::onTimeout(Nightlight *me) {
 }
 void NightlightState::onFinished(Nightlight *me) {
 }
+void NightlightState::setParameters(byte level, byte modWheel) {
+}
 
 bool NightlightState::receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength) {
   if(type == MSG_CHANGE_MODE && sender == -1) {
@@ -258,99 +720,141 @@ void NightlightState::onSerialCommandGoto(char *command, NightlightState *dest)
 
 ///////////////////////////////////////////////////////
 
+OpenNode::OpenNode() {
+  _friendList = 0;
+}
+
 void OpenNode::setState_controlled(NightlightStateWithFriend *dest) {
   _state_controlled = dest;
 }
 
-void OpenNode::start(Nightlight *me) {
-  onTimeout(me);
+/**
+ * Attach the FriendList used to count neighbours, to scale the beacon interval
+ */
+void OpenNode::setFriendList(FriendList *friendList) {
+  _friendList = friendList;
+}
+
+void OpenNode::start(Nightlight *me)
+{
+  start(*me);
+}
+
+/**
+ * Mean interval between beacons.
+ * This grows with the number of neighbours so that the airtime used by a
+ * whole swarm stays roughly constant, much like Trickle.
+ */
+unsigned int OpenNode::beaconInterval() {
+  unsigned long interval = BEACON_MIN_INTERVAL;
+  if(_friendList) {
+    interval = (unsigned long)(_friendList->numNeighbours() + 1) * BEACON_PER_NEIGHBOUR;
+    if(interval < BEACON_MIN_INTERVAL) interval = BEACON_MIN_INTERVAL;
+    if(interval > BEACON_MAX_INTERVAL) interval = BEACON_MAX_INTERVAL;
+  }
+  return interval;
 }
 
-void OpenNode::onTimeout(Nightlight *me) {
-  me->sendMessage(0, MSG_HELLO, (byte *)"OpenNode", 8);
-  this->setTimeout(2000);
+void OpenNode::onTimeout(Nightlight *me)
+{
+  onTimeout(*me);
 }
   
 bool OpenNode::receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength)
 {
-  if(type == MSG_CONTROL_REQUEST) {
-    _state_controlled->setFriend(sender);
-    me->pushState(_state_controlled);
-    return true;
-  }
-
-  NightlightState::receiveMessage(me, sender, type, data, dataLength);
-
-  return false;
+  return receiveMessage(*me, sender, type, data, dataLength);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////
 
+ControlledNode::ControlledNode() {
+  _patterns = 0;
+}
+
 void ControlledNode::setCommand(NightlightState *command) {
   _command = command;
 }
+/**
+ * Play patterns from a PatternStore for the commands it has, instead of the command state
+ */
+void ControlledNode::setPatterns(PatternPlayer *patterns) {
+  _patterns = patterns;
+}
 void ControlledNode::setState_lostControl(NightlightState *dest) {
   _state_lostControl = dest;
 }
-void ControlledNode::start(Nightlight *me) {
-  me->sendMessage(_friendAddress, MSG_CONTROL_START, 0, 0);
+void ControlledNode::start(Nightlight *me)
+{
+  start(*me);
+}
+
+void ControlledNode::onTimeout(Nightlight *me)
+{
+  onTimeout(*me);
 }
-void ControlledNode::onFinished(Nightlight *me) {
-  me->sendMessage(_friendAddress, MSG_COMMAND_END, 0, 0);
+
+void ControlledNode::onFinished(Nightlight *me)
+{
+  onFinished(*me);
 }
 
 bool ControlledNode::receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength)
 {
-  if(type == MSG_COMMAND_SEND) {
-    if(sender == _friendAddress) {
-      me->sendMessage(_friendAddress, MSG_COMMAND_START, 0, 0);
-      me->pushState(_command);
-      _command->notifyFinished(this);
-      return true;
-    }
-  }
+  return receiveMessage(*me, sender, type, data, dataLength);
+}
 
-  // Prevent the event from bubbling
-  if(type == MSG_CONTROL_REQUEST) return true;
+////////////////////////////////////////////////////////////////////////////////////
 
-  return false;
+ControllerState::ControllerState() {
+  _workingChannel = CHANNEL_NONE;
 }
 
-////////////////////////////////////////////////////////////////////////////////////
+/**
+ * Talk to controlled nodes on a channel of their own, instead of the rendezvous channel
+ */
+void ControllerState::setWorkingChannel(byte channel) {
+  _workingChannel = channel;
+}
 
-void ControllerState::start(Nightlight *me) {
-  _numControlling = 0;
+void ControllerState::start(Nightlight *me)
+{
+  start(*me);
 }
 
-bool ControllerState::receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength)
+void ControllerState::onTimeout(Nightlight *me)
 {
-  int i;
+  onTimeout(*me);
+}
 
-  if(type == MSG_COMMAND_SEND && sender == -1) {
-    if(_numControlling > 0) {
-      for(i=0; i<_numControlling; i++) {
-        Serial.print("00 Sending a beat to ");
-        Serial.println(_controlling[i]);
-        me->sendMessage(_controlling[i], MSG_COMMAND_SEND, 0, 0);
-      }
-      
-    } else {
-      Serial.println("00 No nodes currently under control");
-    }
-    return true;
-  }
+bool ControllerState::receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength)
+{
+  return receiveMessage(*me, sender, type, data, dataLength);
+}
 
-  if(type == MSG_HELLO) {
-    me->sendMessage(sender, MSG_CONTROL_REQUEST, 0, 0);
-    return true;
-  }    
+/**
+ * Let go of a node, queueing a MSG_CONTROL_STOP so that it goes back to being
+ * open and can be asked again
+ */
+void ControllerState::_release(byte node) {
+  _forget(node);
+  _releases.add(node);
+}
 
-  if(type == MSG_CONTROL_START) {
-    _controlling[_numControlling] = sender;
-    _numControlling++;
-  }
+/**
+ * Let go of a node without telling it, e.g. because it has let go itself
+ */
+void ControllerState::_forget(byte node) {
+  _controlling.remove(node);
+  _heard.remove(node);
+  _releases.remove(node);
+}
 
-  return false;
+bool ControllerState::isControlling(byte node) {
+  return _controlling.contains(node);
+}
+
+byte ControllerState::numControlling() {
+  return _controlling.count();
 }
 
 void outputBytes(byte *data, byte len) {
@@ -371,86 +875,731 @@ void outputBytes(byte *data, byte len) {
 
 void BlinkyLight::start(Nightlight *me)
 {
-  pinMode(2, OUTPUT);
+  start(*me);
+}
+
+void BlinkyLight::onTimeout(Nightlight *me)
+{
+  onTimeout(*me);
+}
 
-  _on = true;
-  _die = millis() + 2000;
+////////////////////////////////////////////////////////////////////////////////////
 
-  this->onTimeout(me);
+Animation::Animation()
+{
+  _numChannels = 0;
+  setParameters(0, 0);
 }
 
-void BlinkyLight::onTimeout(Nightlight *me)
+/**
+ * Add a channel that plays keyframes (in PROGMEM) on an output pin.
+ * Returns false if all ANIMATION_MAX_CHANNELS are in use.
+ */
+bool Animation::addChannel(byte pin, const Keyframe *keyframes, byte numKeyframes, byte loops, unsigned int delay)
+{
+  if(_numChannels >= ANIMATION_MAX_CHANNELS) return false;
+
+  AnimationChannel *channel = _channels + _numChannels;
+  channel->pin = pin;
+  channel->keyframes = keyframes;
+  channel->numKeyframes = numKeyframes;
+  channel->loops = loops;
+  channel->delay = delay;
+  _numChannels++;
+  return true;
+}
+
+void Animation::clearChannels()
 {
-  digitalWrite(2, _on);
-  _on = !_on;
+  _numChannels = 0;
+}
 
-  if(millis() > _die) {
-    digitalWrite(2, false);
-    this->finish(me);
+/**
+ * Level 0 means "not applicable", and plays at full brightness.
+ * Mod-wheel 0 plays at normal speed, 255 at 4x speed.
+ */
+void Animation::setParameters(byte level, byte modWheel)
+{
+  _level = level ? level + 1 : 256;
+  _speed = 256 + modWheel * 3;
+}
 
-  } else { 
-   this->setTimeout(100);
+void Animation::start(Nightlight *me)
+{
+  start(*me);
+}
+
+void Animation::onTimeout(Nightlight *me)
+{
+  onTimeout(*me);
+}
+
+/**
+ * Rewind every channel to its first keyframe
+ */
+void Animation::reset(unsigned long now)
+{
+  byte i;
+  for(i=0; i<_numChannels; i++) {
+    AnimationChannel *channel = _channels + i;
+    channel->index = 0;
+    channel->loopsLeft = channel->loops;
+    channel->elapsed = -(long)channel->delay;
+    channel->from = 0;
+    channel->value = 0;
+    channel->output = 0;
+    writeChannel(channel->pin, 0);
+  }
+  _lastUpdate = now;
+}
+
+/**
+ * Advance all channels to the given time and write their outputs.
+ * Returns false once every channel has played its last keyframe.
+ */
+bool Animation::update(unsigned long now)
+{
+  // Scale the time step once per frame rather than once per channel
+  unsigned long step = ((now - _lastUpdate) * _speed) >> 8;
+  _lastUpdate = now;
+
+  bool running = false;
+  byte i;
+  for(i=0; i<_numChannels; i++) {
+    AnimationChannel *channel = _channels + i;
+    if(_updateChannel(channel, step)) running = true;
+
+    // Apply level before gamma correction, so brightness scales perceptually
+    byte output = pgm_read_byte(GAMMA_TABLE + (((channel->value >> 8) * _level) >> 8));
+    if(output != channel->output) {
+      channel->output = output;
+      writeChannel(channel->pin, output);
+    }
+  }
+  return running;
+}
+
+bool Animation::_updateChannel(AnimationChannel *channel, unsigned long step)
+{
+  if(channel->index >= channel->numKeyframes) return false;
+
+  channel->elapsed += step;
+  if(channel->elapsed < 0) return true;
+
+  Keyframe keyframe;
+  byte number = channel - _channels;
+  readKeyframe(number, channel->index, &keyframe);
+
+  // Skip past any keyframes that finished during this step
+  while(channel->elapsed >= keyframe.duration) {
+    channel->elapsed -= keyframe.duration;
+    channel->from = (uint16_t)keyframe.value << 8;
+    channel->index++;
+
+    if(channel->index >= channel->numKeyframes) {
+      if(channel->loopsLeft == 0) {
+        channel->value = channel->from;
+        return false;
+      }
+      channel->loopsLeft--;
+      channel->index = 0;
+    }
+    readKeyframe(number, channel->index, &keyframe);
+  }
+
+  byte progress = (channel->elapsed << 8) / keyframe.duration;
+  long delta = ((long)keyframe.value << 8) - channel->from;
+  channel->value = channel->from + ((delta * easeProgress(keyframe.easing, progress)) >> 8);
+  return true;
+}
+
+/**
+ * The last value written to a channel, after level and gamma correction
+ */
+byte Animation::channelOutput(byte channel)
+{
+  return _channels[channel].output;
+}
+
+void Animation::writeChannel(byte pin, byte value)
+{
+  analogWrite(pin, value);
+}
+
+/**
+ * Fetch a keyframe of a channel, from PROGMEM unless overridden
+ */
+void Animation::readKeyframe(byte channel, byte index, Keyframe *keyframe)
+{
+  memcpy_P(keyframe, _channels[channel].keyframes + index, sizeof(Keyframe));
+}
+
+// Keyframe presets
+
+const Keyframe FADE_KEYFRAMES[] PROGMEM = {
+  { 500, 255, EASE_OUT },
+  { 1500, 0, EASE_IN_OUT },
+};
+
+const Keyframe PULSE_KEYFRAMES[] PROGMEM = {
+  { 150, 255, EASE_OUT },
+  { 350, 0, EASE_IN },
+};
+
+const Keyframe CHASE_KEYFRAMES[] PROGMEM = {
+  { 100, 255, EASE_LINEAR },
+  { 400, 0, EASE_OUT },
+};
+
+FadeLight::FadeLight(byte pin)
+{
+  addChannel(pin, FADE_KEYFRAMES, 2);
+}
+
+PulseLight::PulseLight(byte pin)
+{
+  addChannel(pin, PULSE_KEYFRAMES, 2, 2);
+}
+
+ChaseLights::ChaseLights(const byte *pins, byte numPins)
+{
+  byte i;
+  for(i=0; i<numPins; i++) {
+    addChannel(pins[i], CHASE_KEYFRAMES, 2, 0, i * 100);
   }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////
 
+const byte PATTERN_MARKER = 0x5A;      // First byte of a record's header
+const unsigned int PATTERN_NO_PAGE = 0xFFFF;
+
 /**
- * Kick off the timeout
+ * Pages taken by a record with a pattern of this length
  */
-void FriendList::start(Nightlight *me)
+static unsigned int patternPages(unsigned int length)
 {
-  _numFriends = 0;
-  this->setTimeout(1000);
+  return (PATTERN_HEADER_LENGTH + length + PATTERN_PAGE_SIZE - 1) / PATTERN_PAGE_SIZE;
 }
 
-bool FriendList::receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength)
+PatternStore::PatternStore(unsigned int start, unsigned int size)
 {
-  int i;
-  if(type == MSG_HELLO) {
-    for(i=0; i<_numFriends; i++) {
-      // Match, push out time
-      if(_friends[i] == sender) {
-        _timeout[i] = millis() + 5000;
-        return true;
-      }
+  byte i;
+  _start = start;
+  _numPages = size / PATTERN_PAGE_SIZE;
+  _numEntries = 0;
+  _sequence = 0;
+  _nextPage = 0;
+  _heldPages = 0;
+  _writing = false;
+
+  for(i=0; i<PATTERN_CACHE_LINES; i++) {
+    _cacheTags[i] = PATTERN_NO_PAGE;
+  }
+  _cacheNext = 0;
+  _cacheMisses = 0;
+}
+
+/**
+ * Rebuild the index from the records in EEPROM, e.g. after a reset
+ */
+void PatternStore::load()
+{
+  unsigned int page, address, length, i;
+  uint16_t crc, sequence, newest = 0;
+  bool found = false;
+
+  _numEntries = 0;
+  _nextPage = 0;
+  for(page=0; page<_numPages; page++) {
+    address = _start + page * PATTERN_PAGE_SIZE;
+    if(EEPROM.read(address) != PATTERN_MARKER) continue;
+
+    length = EEPROM.read(address + 2) | (EEPROM.read(address + 3) << 8);
+    if(!length || page + patternPages(length) > _numPages) continue;
+
+    // Records are only valid once the header is written, and only if the pattern is intact
+    crc = 0xFFFF;
+    for(i=0; i<length; i++) {
+      crc = crc16Update(crc, EEPROM.read(address + PATTERN_HEADER_LENGTH + i));
     }
+    if(crc != (EEPROM.read(address + 6) | (EEPROM.read(address + 7) << 8))) continue;
 
-    // No match, add to list, send appear message
-    _friends[_numFriends] = sender;
-    _timeout[_numFriends] = millis() + 5000;
-    _numFriends++;
+    sequence = EEPROM.read(address + 4) | (EEPROM.read(address + 5) << 8);
+    _index(EEPROM.read(address + 1), page, length, sequence);
 
-    me->sendMessage(me->_myAddressOffset, MSG_APPEAR, (byte *)&sender, 1);
-    return true;
+    // Carry on writing after the newest record
+    if(!found || (int16_t)(sequence - newest) > 0) {
+      newest = sequence;
+      _nextPage = page + patternPages(length);
+      found = true;
+    }
   }
+  _sequence = newest + 1;
 
-  return false;
+  for(i=0; i<PATTERN_CACHE_LINES; i++) {
+    _cacheTags[i] = PATTERN_NO_PAGE;
+  }
 }
 
 /**
- * Cleanup disappeared notes every second
+ * Start receiving a pattern, reserving room for it.
+ * Returns false if there is no room.
  */
-void FriendList::onTimeout(Nightlight *me)
+bool PatternStore::beginPattern(byte command, unsigned int length, uint16_t crc)
 {
-  int i, j;
-  unsigned long m = millis();
-  for(i=0; i<_numFriends; i++) {
-    // Timeout reached, send a disappear mesasge
-    if(_timeout[i] < m) {
-      me->sendMessage(me->_myAddressOffset, MSG_DISAPPEAR, _friends+i, 1);
-
-      // Remove element from array
-      for(j=i; j<_numFriends-1; j++) {
-        _friends[i] = _friends[i+1];
-        _timeout[i] = _timeout[i+1];
+  abortPattern();
+  if(!length) return false;
+  if(find(command) < 0 && _numEntries >= PATTERN_MAX_ENTRIES) return false;
+
+  _page = _allocate(patternPages(length));
+  if(_page == PATTERN_NO_PAGE) return false;
+
+  _writing = true;
+  _command = command;
+  _length = length;
+  _received = 0;
+  _crc = 0xFFFF;
+  _expectedCrc = crc;
+  return true;
+}
+
+/**
+ * Append the next part of the pattern, writing each page as it fills.
+ * Returns false, and abandons the pattern, if it is out of order or a write fails.
+ */
+bool PatternStore::writePattern(unsigned int offset, const byte *data, byte length)
+{
+  byte i;
+  unsigned int position, page;
+  byte at;
+
+  if(!_writing || offset != _received || _received + length > _length) {
+    abortPattern();
+    return false;
+  }
+
+  for(i=0; i<length; i++) {
+    position = PATTERN_HEADER_LENGTH + _received;
+    page = position / PATTERN_PAGE_SIZE;
+    at = position % PATTERN_PAGE_SIZE;
+    _crc = crc16Update(_crc, data[i]);
+    _received++;
+
+    // The first page shares space with the header, so is kept until endPattern()
+    if(page == 0) {
+      _first[at] = data[i];
+      continue;
+    }
+
+    _buffer[at] = data[i];
+    if(at == PATTERN_PAGE_SIZE - 1 || _received == _length) {
+      if(!_writePage(_page + page, _buffer, at + 1)) {
+        abortPattern();
+        return false;
       }
-      i--;
-      _numFriends--;
     }
   }
+  return true;
+}
+
+/**
+ * Check the pattern and commit it by writing its header.
+ * The pattern then replaces any older one for the same command.
+ */
+bool PatternStore::endPattern()
+{
+  if(!_writing || _received != _length || _crc != _expectedCrc) {
+    abortPattern();
+    return false;
+  }
+  _writing = false;
+
+  _first[0] = PATTERN_MARKER;
+  _first[1] = _command;
+  _first[2] = _length;
+  _first[3] = _length >> 8;
+  _first[4] = _sequence;
+  _first[5] = _sequence >> 8;
+  _first[6] = _crc;
+  _first[7] = _crc >> 8;
+
+  unsigned int length = PATTERN_HEADER_LENGTH + _length;
+  if(!_writePage(_page, _first, length < PATTERN_PAGE_SIZE ? length : PATTERN_PAGE_SIZE)) return false;
+
+  _index(_command, _page, _length, _sequence);
+  _sequence++;
+  _nextPage = _page + patternPages(_length);
+  return true;
+}
+
+/**
+ * Abandon the pattern being written; whatever it was replacing stays
+ */
+void PatternStore::abortPattern()
+{
+  _writing = false;
+}
 
-  this->setTimeout(1000);
+bool PatternStore::writing()
+{
+  return _writing;
+}
+
+/**
+ * Index of the pattern for a command, or -1
+ */
+int PatternStore::find(byte command)
+{
+  int low = 0, high = _numEntries - 1, middle;
+  while(low <= high) {
+    middle = (low + high) / 2;
+    if(_entries[middle].command == command) return middle;
+    if(_entries[middle].command < command) low = middle + 1;
+    else high = middle - 1;
+  }
+  return -1;
+}
+
+/**
+ * Index of the pattern to play for a command: its own, or else another
+ * option in the same bank, picked by the option number. -1 if the bank is empty.
+ */
+int PatternStore::select(byte command)
+{
+  int index = find(command);
+  if(index >= 0) return index;
+
+  byte bank = command >> 4;
+  byte first, count = 0;
+  for(first=0; first<_numEntries && (_entries[first].command >> 4) < bank; first++);
+  while(first + count < _numEntries && (_entries[first + count].command >> 4) == bank) count++;
+
+  if(!count) return -1;
+  return first + (command & 0x0F) % count;
+}
+
+byte PatternStore::numPatterns()
+{
+  return _numEntries;
+}
+
+const PatternEntry *PatternStore::entry(int index)
+{
+  return _entries + index;
+}
+
+/**
+ * EEPROM address of the first byte of a pattern, for read()
+ */
+unsigned int PatternStore::patternAddress(int index)
+{
+  return _start + _entries[index].page * PATTERN_PAGE_SIZE + PATTERN_HEADER_LENGTH;
+}
+
+/**
+ * Read a byte of the store through the cache
+ */
+byte PatternStore::read(unsigned int address)
+{
+  unsigned int tag = (address - _start) / PATTERN_PAGE_SIZE;
+  byte at = (address - _start) % PATTERN_PAGE_SIZE;
+  byte i, j;
+
+  for(i=0; i<PATTERN_CACHE_LINES; i++) {
+    if(_cacheTags[i] == tag) return _cache[i][at];
+  }
+
+  // Replace lines round-robin
+  i = _cacheNext;
+  _cacheNext = (i + 1) % PATTERN_CACHE_LINES;
+  _cacheMisses++;
+
+  for(j=0; j<PATTERN_PAGE_SIZE; j++) {
+    _cache[i][j] = EEPROM.read(_start + tag * PATTERN_PAGE_SIZE + j);
+  }
+  _cacheTags[i] = tag;
+  return _cache[i][at];
+}
+
+unsigned long PatternStore::cacheMisses()
+{
+  return _cacheMisses;
+}
+
+/**
+ * Keep a record's pages from being reused while a PatternPlayer reads them,
+ * even after a newer pattern replaces it in the index. One record is held at a
+ * time; -1 holds none.
+ */
+void PatternStore::hold(int index)
+{
+  if(index < 0) {
+    _heldPages = 0;
+    return;
+  }
+  _heldPage = _entries[index].page;
+  _heldPages = patternPages(_entries[index].length);
+}
+
+/**
+ * First page of a free run of pages, looking from where the last record ended.
+ * Only the patterns in the index, and the held one, are kept; anything else may
+ * be overwritten.
+ */
+unsigned int PatternStore::_allocate(unsigned int pages)
+{
+  unsigned int start = _nextPage;
+  byte i, tries;
+
+  if(pages > _numPages) return PATTERN_NO_PAGE;
+
+  for(tries=0; tries <= 2 * (_numEntries + 1) + 1; tries++) {
+    if(start + pages > _numPages) start = 0;
+
+    for(i=0; i<_numEntries; i++) {
+      PatternEntry *entry = _entries + i;
+      if(entry->page < start + pages && start < entry->page + patternPages(entry->length)) break;
+    }
+
+    // Skip past the pattern in the way
+    if(i < _numEntries) {
+      start = _entries[i].page + patternPages(_entries[i].length);
+    } else if(_heldPages && _heldPage < start + pages && start < _heldPage + _heldPages) {
+      start = _heldPage + _heldPages;
+    } else {
+      return start;
+    }
+  }
+  return PATTERN_NO_PAGE;
+}
+
+/**
+ * Write (part of) a page, skipping unchanged bytes, and check that it took
+ */
+bool PatternStore::_writePage(unsigned int page, const byte *data, byte length)
+{
+  unsigned int address = _start + page * PATTERN_PAGE_SIZE;
+  byte i;
+
+  for(i=0; i<length; i++) {
+    EEPROM.update(address + i, data[i]);
+  }
+
+  for(i=0; i<PATTERN_CACHE_LINES; i++) {
+    if(_cacheTags[i] == page) _cacheTags[i] = PATTERN_NO_PAGE;
+  }
+
+  // A worn out cell won't hold its value
+  for(i=0; i<length; i++) {
+    if(EEPROM.read(address + i) != data[i]) return false;
+  }
+  return true;
+}
+
+/**
+ * Add a record to the index, unless there is a newer one for its command
+ */
+void PatternStore::_index(byte command, unsigned int page, uint16_t length, uint16_t sequence)
+{
+  byte i, j;
+  for(i=0; i<_numEntries && _entries[i].command < command; i++);
+
+  if(i < _numEntries && _entries[i].command == command) {
+    if((int16_t)(sequence - _entries[i].sequence) < 0) return;
+  } else {
+    if(_numEntries >= PATTERN_MAX_ENTRIES) return;
+    for(j=_numEntries; j>i; j--) {
+      _entries[j] = _entries[j-1];
+    }
+    _numEntries++;
+  }
+
+  _entries[i].command = command;
+  _entries[i].page = page;
+  _entries[i].length = length;
+  _entries[i].sequence = sequence;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+PatternPlayer::PatternPlayer()
+{
+  _store = 0;
+  _pins = 0;
+  _numPins = 0;
+}
+
+void PatternPlayer::setStore(PatternStore *store)
+{
+  _store = store;
+}
+
+/**
+ * Pins for the outputs numbered in patterns; outputs without a pin aren't played
+ */
+void PatternPlayer::setPins(const byte *pins, byte numPins)
+{
+  _pins = pins;
+  _numPins = numPins;
+}
+
+/**
+ * Set up the channels of the pattern for a command (see PatternStore::select()).
+ * Only the channel headers are read now; keyframes are read as they play, so
+ * the store holds on to the pattern until another is loaded.
+ * Returns false if there is no pattern to play.
+ */
+bool PatternPlayer::load(byte command)
+{
+  clearChannels();
+  if(!_store) return false;
+
+  int index = _store->select(command);
+  _store->hold(index);
+  if(index < 0) return false;
+
+  unsigned int address = _store->patternAddress(index);
+  unsigned int end = address + _store->entry(index)->length;
+  byte numChannels = _store->read(address++);
+  byte i, output, loops, numKeyframes, added = 0;
+  unsigned int delay;
+
+  for(i=0; i<numChannels && address + 5 <= end; i++) {
+    output = _store->read(address);
+    loops = _store->read(address + 1);
+    delay = _store->read(address + 2) | (_store->read(address + 3) << 8);
+    numKeyframes = _store->read(address + 4);
+    address += 5;
+    if(address + numKeyframes * 4 > end) break;
+
+    if(output < _numPins && addChannel(_pins[output], 0, numKeyframes, loops, delay)) {
+      _currentIndex[added] = 0xFF;
+      _keyframes[added++] = address;
+    }
+    address += numKeyframes * 4;
+  }
+  return added > 0;
+}
+
+void PatternPlayer::readKeyframe(byte channel, byte index, Keyframe *keyframe)
+{
+  Keyframe *current = _current + channel;
+
+  if(_currentIndex[channel] != index) {
+    unsigned int address = _keyframes[channel] + index * 4;
+    current->duration = _store->read(address) | (_store->read(address + 1) << 8);
+    current->value = _store->read(address + 2);
+    current->easing = _store->read(address + 3);
+    if(current->easing > EASE_IN_OUT) current->easing = EASE_LINEAR;
+    _currentIndex[channel] = index;
+  }
+  *keyframe = *current;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+PatternReceiver::PatternReceiver()
+{
+  _store = 0;
+  _sender = -1;
+}
+
+void PatternReceiver::setStore(PatternStore *store)
+{
+  _store = store;
+}
+
+void PatternReceiver::onTimeout(Nightlight *me)
+{
+  onTimeout(*me);
+}
+
+bool PatternReceiver::receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength)
+{
+  return receiveMessage(*me, sender, type, data, dataLength);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////
+
+PatternSender::PatternSender()
+{
+  _address = 0;
+  _pattern = 0;
+  _length = 0;
+  _status = PATTERN_PENDING;
+}
+
+/**
+ * The pattern to send when pushed; it must stay in RAM until the sender finishes
+ */
+void PatternSender::setPattern(int address, byte command, const byte *pattern, unsigned int length)
+{
+  _address = address;
+  _command = command;
+  _pattern = pattern;
+  _length = length;
+}
+
+void PatternSender::start(Nightlight *me)
+{
+  start(*me);
+}
+
+void PatternSender::onTimeout(Nightlight *me)
+{
+  onTimeout(*me);
+}
+
+bool PatternSender::receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength)
+{
+  return receiveMessage(*me, sender, type, data, dataLength);
+}
+
+/**
+ * PATTERN_OK once the pattern is stored, PATTERN_PENDING until the receiver
+ * replies, or the reason it wasn't stored
+ */
+byte PatternSender::status()
+{
+  return _status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+void FriendList::start(Nightlight *me)
+{
+  start(*me);
+}
+
+bool FriendList::receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength)
+{
+  return receiveMessage(*me, sender, type, data, dataLength);
+}
+
+void FriendList::onTimeout(Nightlight *me)
+{
+  onTimeout(*me);
+}
+
+/**
+ * Number of nodes being tracked
+ */
+byte FriendList::numFriends()
+{
+  return _numFriends;
+}
+
+/**
+ * Estimate of all nodes in range, including those heard while the list was full
+ */
+byte FriendList::numNeighbours()
+{
+  byte current = _untracked[0].count();
+  byte previous = _untracked[1].count();
+  unsigned int total = _numFriends + (current > previous ? current : previous);
+  return total > 255 ? 255 : total;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////
@@ -489,6 +1638,68 @@ void *Map::get(char *key) {
   return (void *)0;
 }
 
+////////////////////////////////////////////////////////////////////////////////////
+
+NodeSet::NodeSet() {
+  clear();
+}
+
+void NodeSet::clear() {
+  memset(_bits, 0, sizeof(_bits));
+}
+
+void NodeSet::add(byte node) {
+  _bits[node >> 3] |= 1 << (node & 7);
+}
+
+void NodeSet::remove(byte node) {
+  _bits[node >> 3] &= ~(1 << (node & 7));
+}
+
+bool NodeSet::contains(byte node) {
+  return _bits[node >> 3] & (1 << (node & 7));
+}
+
+/**
+ * Number of nodes in the set
+ */
+byte NodeSet::count() {
+  byte i, bits, total = 0;
+  for(i=0; i<32; i++) {
+    for(bits = _bits[i]; bits; bits &= bits - 1) total++;
+  }
+  return total;
+}
+
+/**
+ * The first node in the set after the given one, or -1 if there are none.
+ * Iterate with: for(n = set.next(-1); n >= 0; n = set.next(n))
+ */
+int NodeSet::next(int after) {
+  int node = after + 1;
+  byte i = node >> 3;
+
+  if(node > 255) return -1;
+
+  // Check the rest of the current byte, then skip empty bytes
+  byte bits = _bits[i] >> (node & 7);
+  if(bits) {
+    while(!(bits & 1)) {
+      bits >>= 1;
+      node++;
+    }
+    return node;
+  }
+  for(i++; i<32; i++) {
+    if(_bits[i]) {
+      node = i << 3;
+      for(bits = _bits[i]; !(bits & 1); bits >>= 1) node++;
+      return node;
+    }
+  }
+  return -1;
+}
+
 /**
  * Convert a 2-hex-character ascii-encoded value into a byte, 0-255
  */
@@ -504,6 +1715,36 @@ byte hexChar(char ascii) {
   return (ascii >= 'A') ? ascii - 'A' + 10 : ascii - '0';
 }
 
+/**
+ * CRC-16/CCITT, starting from 0xFFFF
+ */
+uint16_t crc16Update(uint16_t crc, byte value) {
+  byte i;
+  crc ^= (uint16_t)value << 8;
+  for(i=0; i<8; i++) {
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+/**
+ * The PRIORITY_* class of a message type
+ */
+byte messagePriority(byte type) {
+  if(type < MSG_CONTROL_REQUEST) return PRIORITY_PRESENCE;
+  if(type < MSG_COMMAND_SEND) return PRIORITY_CONTROL;
+  if(type < MSG_EVENT) return PRIORITY_COMMAND;
+  return PRIORITY_TELEMETRY;
+}
+
+/**
+ * Apply an EASE_* curve to progress through a keyframe, both 0-255
+ */
+byte easeProgress(byte easing, byte progress) {
+  if(easing == EASE_LINEAR) return progress;
+  return pgm_read_byte(EASING_TABLE[easing - 1] + progress);
+}
+
 #ifdef DEBUG_MESSAGES
 void sendDebugMessage(char *prefix, int address, byte myAddress, byte type, byte dataLength, byte *data) {
   // Debug message about sending
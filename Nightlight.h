@@ -1,9 +1,20 @@
 //#define DEBUG_MESSAGES
 
+#include <stdint.h>
 typedef unsigned char byte;
-typedef unsigned long long uint64_t;
 
 #include <RF24.h>
+#include <nRF24L01.h>
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#endif
+#ifndef pgm_read_byte
+#include <string.h>
+#define PROGMEM
+#define pgm_read_byte(address) (*(const byte *)(address))
+#define memcpy_P memcpy
+#endif
 
 #ifndef Nightlight_h
 #define Nightlight_h
@@ -11,39 +22,76 @@ typedef unsigned long long uint64_t;
 // Configuration constants
 
 const byte MAP_MAX_ITEMS = 5;    // Maximum number of items in a Map class
-const byte CONTROLLER_MAX_NODES = 8;  // Maximum number of nodes that can be controlled
+const int CONTROLLER_REQUEST_INTERVAL = 100;     // How often a controller sends queued MSG_CONTROL_REQUESTs, in msec
+const byte CONTROLLER_REQUESTS_PER_INTERVAL = 4; // Maximum number of MSG_CONTROL_REQUESTs sent per interval
+const unsigned int CONTROLLER_NODE_TIMEOUT = 6000; // Release controlled nodes unheard for this long, or longer if they beacon less often
 const byte STATE_STACK_SIZE = 5; // Maximum number of concurrently-running states
+const unsigned long NO_TIMEOUT = 0xFFFFFFFF; // Returned by Nightlight::nextTimeout() when nothing is scheduled
 const int FRAME_LENGTH = 25;     // Frame length in msec
-
-
-// Message types
-
-// Presence notification
-const byte MSG_HELLO = 0x01; // Send this every X secondas
-const byte MSG_APPEAR = 0x02; // Generate this when new nodes appear (e.g. from FriendList)
-const byte MSG_DISAPPEAR = 0x03; // Generate this when nodes disappear (e.g. from FriendList)
-
-// Negotation remote control of devices
-const byte MSG_CONTROL_REQUEST = 0x08; // Request control, can be broadcast or unicast
-const byte MSG_CONTROL_START = 0x09; // Positive response to MSG_CONTROL_REQUEST to start remote-control
-const byte MSG_CONTROL_STOP = 0x0A; // Cancel a previous remote-control session
-
-// Sending commands to remote-controlled devices
-const byte MSG_COMMAND_SEND = 0x10; // Send a command to a remote-controlled device
-const byte MSG_COMMAND_START = 0x11; // Successfully received a remote-control command, and activity started
-const byte MSG_COMMAND_END = 0x11; // Activity finished (e.g. animation completed)
-
-// Events
-const byte MSG_EVENT = 0x18;
-
-// Operational control (from serial)
-const byte MSG_CHANGE_MODE = 0x20;
-
-const byte FRIENDLIST_MAX_NODES = 16;
+const byte ANIMATION_MAX_CHANNELS = 8; // Maximum number of channels animated by one Animation
+
+
+#include "NightlightMessages.h"
+
+const byte FRIENDLIST_MAX_NODES = 32;  // Nodes tracked individually, with MSG_APPEAR and MSG_DISAPPEAR
+const unsigned long FRIENDLIST_GENERATION = 40000; // How long untracked nodes still count as neighbours, in msec
+
+// Presence beacons (MSG_HELLO)
+const byte NODE_KIND_OPEN = 0x01;             // Identity sent in the first byte of MSG_HELLO
+const byte NODE_KIND_CONTROLLER = 0x02;       // A controller, beaconing to the nodes it controls
+const unsigned int BEACON_INTERVAL_UNIT = 100; // Units of the interval advertised in MSG_HELLO, in msec
+const unsigned int BEACON_MIN_INTERVAL = 2000; // Mean interval between beacons with few neighbours
+const unsigned int BEACON_MAX_INTERVAL = 25500;
+const unsigned int BEACON_PER_NEIGHBOUR = 100; // Mean interval grows by this per neighbour, keeping total airtime constant
+const byte BEACON_EXPIRY_FACTOR = 3;          // Forget a node after this many advertised intervals without a beacon
+
+// Priority classes for radio traffic, highest first
+const byte PRIORITY_COMMAND = 0;   // MSG_COMMAND_*, always sent, taking airtime from lower classes if needed
+const byte PRIORITY_CONTROL = 1;   // MSG_CONTROL_*, deferred when over budget
+const byte PRIORITY_PRESENCE = 2;  // MSG_HELLO etc., dropped when over budget
+const byte PRIORITY_TELEMETRY = 3; // MSG_EVENT and everything else, deferred when over budget
+const byte PRIORITY_CLASSES = 4;
+
+const byte SEND_QUEUE_SIZE = 4;       // Frames deferred until their class has airtime budget again
+const byte RADIO_FRAME_OVERHEAD = 9;  // Preamble, address, control field and CRC bytes added to each payload
+const byte BUDGET_REFILL_PERIOD = 10; // Airtime budgets are topped up at most this often, in msec
+
+// Radio channels
+const byte CHANNEL_RENDEZVOUS = 76;   // Shared channel for discovery, MSG_HELLO and MSG_CONTROL_REQUEST
+// CHANNEL_NONE, which is sent in MSG_CONTROL_REQUEST, is in NightlightMessages.h
+const unsigned int CONTROLLER_DISCOVERY_PERIOD = 2000; // How often a controller with a working channel visits the rendezvous channel
+const unsigned int CONTROLLER_DISCOVERY_WINDOW = 500;  // How long it stays there
+const unsigned int CONTROLLER_BEACON_INTERVAL = 1000;  // How often a controller tells the nodes it controls that it's still there
+const unsigned int CONTROLLER_LOST_TIMEOUT = 5000;     // A controlled node goes back to being open after this long without hearing its controller
+
+// Link quality
+const byte LINK_TABLE_SIZE = 8;   // Peers with link statistics, least recently used are forgotten
+const byte LINK_MIN_RETRIES = 3;  // Fewest auto-retries for a unicast frame
+const byte LINK_MAX_RETRIES = 15; // Most auto-retries for a unicast frame (the radio's limit)
+const byte LINK_POOR = 64;        // Success ratio (of 255) below which a link gets the fewest retries
+const byte LINK_GOOD = 240;       // Success ratio (of 255) above which transmit power is lowered
+
+// Easing curves for animation keyframes
+const byte EASE_LINEAR = 0;
+const byte EASE_IN = 1;
+const byte EASE_OUT = 2;
+const byte EASE_IN_OUT = 3;
+
+// Pattern store in EEPROM
+const unsigned int PATTERN_STORE_SIZE = 1024;   // Bytes of EEPROM used by default, from address 0
+const byte PATTERN_PAGE_SIZE = 16;              // Unit of allocation, of batched writes and of the read cache
+const byte PATTERN_HEADER_LENGTH = 8;           // Marker, command, length, sequence and CRC at the start of each record
+const byte PATTERN_MAX_ENTRIES = 16;            // Patterns indexed in RAM
+const byte PATTERN_CACHE_LINES = 4;             // Pages kept by the read cache
+const unsigned int PATTERN_TRANSFER_TIMEOUT = 2000; // Give up on a transfer after this long without a chunk, in msec
+const byte PATTERN_PENDING = 0xFF;              // PatternSender::status() until the receiver replies
+const byte PATTERN_TIMEOUT = 0xFE;              // PatternSender::status() if the receiver never replied
 
 class Nightlight;
 class NightlightState;
 class Map;
+class NodeSet;
+class FriendList;
 
 /**
  * Represents a simple map with 5 elements; mapping keys to (void *) values
@@ -60,28 +108,175 @@ class Map {
     void *_values[MAP_MAX_ITEMS];
 };
 
-class Nightlight {
+/**
+ * A message read from the radio or serial port, before it is dispatched
+ */
+struct NightlightMessage {
+  int sender;
+  byte type;
+  byte *data;
+  byte dataLength;
+  char buffer[80];
+};
+
+/**
+ * A set of node addresses, 0-255, stored as a 32 byte bitmap
+ */
+class NodeSet {
   public:
-    Nightlight(uint64_t broadcast);
+    NodeSet();
+    void clear();
+    void add(byte node);
+    void remove(byte node);
+    bool contains(byte node);
+    byte count();
+    int next(int after);
+
+  private:
+    byte _bits[32];
+};
+
+/**
+ * Airtime budget and counters for one priority class
+ */
+struct TrafficClass {
+  unsigned int rate;     // Budget refill, in bytes of airtime per second
+  unsigned int burst;    // Maximum budget, in bytes
+  unsigned int tokens;   // Budget available now, in bytes
+
+  unsigned int sent;
+  unsigned int deferred;
+  unsigned int dropped;
+};
+
+/**
+ * Airtime budget taken by a radio frame carrying a packet of this length
+ */
+inline unsigned int frameCost(byte packetLength) {
+  return (unsigned int)packetLength + RADIO_FRAME_OVERHEAD;
+}
+
+/**
+ * Link statistics for one peer
+ */
+struct LinkStats {
+  byte address;
+  byte successRatio; // Moving average of acknowledged frames, 0-255
+  byte retries;      // Moving average of retries per frame, 4.4 fixed point
+  unsigned int sent;
+  unsigned int failed;
+  unsigned int busy; // Failures with a carrier on the channel, i.e. interference rather than range
+};
+
+/**
+ * RF24 with access to the observe register, for retry counts
+ */
+class NightlightRadio : public RF24 {
+  public:
+    NightlightRadio(int cePin, int csPin) : RF24(cePin, csPin) {}
+
+    byte retriesLastFrame() {
+      return read_register(OBSERVE_TX) & 0x0F;
+    }
+};
+
+/**
+ * A radio frame waiting for airtime
+ */
+struct QueuedFrame {
+  int address;
+  byte channel;
+  byte priority;
+  byte length;
+  byte packet[32];
+};
+
+/**
+ * The radio and serial transport, without any states: the radio, link table,
+ * airtime budgets and send queue. Nightlight adds its state stack on top of
+ * this, and StaticNightlight uses it on its own.
+ */
+class NightlightLink {
+  public:
+    NightlightLink(uint64_t broadcast);
     void setup();
+    void enableSerial();
+
+    // Radio and serial I/O without any state dispatch
+    bool readRadio(NightlightMessage *message);
+    bool readSerial(NightlightMessage *message);
+    void transmit(int address, byte type, byte *data, byte dataLength);
+    bool canTransmit(int address, byte type, byte dataLength);
+    void transmitQueued();
+    byte queuedFrames();
+    unsigned long rejectedFrames();
+
+    void setChannel(byte channel);
+    byte channel();
+    byte myAddress() { return _myAddressOffset; }
+
+    // Link quality
+    const LinkStats *linkStats(byte address);
+    void setLinkAdaptation(bool enable);
+
+    // Airtime budgets
+    void setBudget(byte priority, unsigned int rate, unsigned int burst);
+    const TrafficClass *trafficStats(byte priority);
+
+    byte _myAddressOffset; // The offset, 0-255, of the personal address
+    
+  private:
+    uint64_t _broadcast; // The broadcast address, last 2 bytes must be 00
+    NightlightRadio _radio;
+    byte _channel;
+
+    LinkStats _links[LINK_TABLE_SIZE];
+    byte _numLinks;
+    bool _linkAdaptation;
+
+    TrafficClass _traffic[PRIORITY_CLASSES];
+    unsigned long _lastRefill;
+    QueuedFrame _queue[SEND_QUEUE_SIZE];
+    byte _queueLength;
+    unsigned long _rejected;
+
+    void _refill();
+    bool _spend(byte priority, unsigned int cost);
+    bool _queued(byte priority);
+    void _defer(int address, byte priority, byte *packet, byte length);
+    void _write(int address, byte channel, byte *packet, byte length);
+    LinkStats *_link(byte address);
+};
+
+class Nightlight : public NightlightLink {
+  public:
+    Nightlight(uint64_t broadcast);
     void loop();
     void sendMessage(int address, byte type, byte *data, byte dataLength);
-    void enableSerial();
+    unsigned long nextTimeout();
+
+    /**
+     * Send a message described in NightlightMessages.h
+     */
+    template<class T> void send(int address, const T &message) {
+      sendMessage(address, T::TYPE, (byte *)&message, T::LENGTH);
+    }
+
+    bool sendNow(int address, byte type, byte *data, byte dataLength);
+    template<class T> bool sendNow(int address, const T &message) {
+      return sendNow(address, T::TYPE, (byte *)&message, T::LENGTH);
+    }
 
     void pushState(NightlightState *state);
     void changeState(NightlightState *from, NightlightState *to);
     void removeState(NightlightState *state);
+    byte numStates();
 
-    byte _myAddressOffset; // The offset, 0-255, of the personal address
-    
   private:
-    uint64_t _broadcast; // The broadcast address, last 2 bytes must be 00
-    RF24 _radio;
     NightlightState *_states[STATE_STACK_SIZE];
     byte _numStates;
 
-    void _handleRadioInput();
-    void _handleSerialInput();
+    void _dispatch(int sender, byte type, byte *data, byte dataLength);
 };
 
 /**
@@ -89,8 +284,11 @@ class Nightlight {
  */
 class NightlightState {
   public:
+    NightlightState();
+
     virtual void start(Nightlight *me);
     void finish(Nightlight *me);
+    void finish(Nightlight &me) { finish(&me); }
 
     // Event handlers
     virtual void onTimeout(Nightlight *me);
@@ -104,6 +302,24 @@ sender: 1-255 = radio devices
 */
     virtual bool receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength);
 
+    // The serial commands from onSerialCommandGoto(), for the stock states' handlers to fall back on
+    bool receiveMessage(Nightlight &me, int sender, byte type, byte *data, byte dataLength) {
+      return NightlightState::receiveMessage(&me, sender, type, data, dataLength);
+    }
+
+    // The "level" and "mod-wheel" parameters of MSG_COMMAND_SEND, passed in before start()
+    virtual void setParameters(byte level, byte modWheel);
+
+    // Handlers on a StaticNightlight, hidden by the same names in the stock states;
+    // see NightlightStates.h
+    template<class M> void start(M &me) {}
+    template<class M> void onTimeout(M &me) {}
+    template<class M> void onFinished(M &me) {}
+    template<class M> bool receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength) {
+      return false;
+    }
+    template<class M> void finish(M &me);
+
     // Configuration
     void onSerialCommandGoto(char *command, NightlightState *dest);
     void setTimeout(unsigned long millis);
@@ -123,27 +339,39 @@ sender: 1-255 = radio devices
  */
 class NightlightStateWithFriend : public NightlightState {
   public:
-    void setFriend(uint64_t friendAddress) {
+    void setFriend(uint64_t friendAddress, byte friendChannel = CHANNEL_NONE) {
       _friendAddress = friendAddress;
+      _friendChannel = friendChannel;
     }
 
   protected:
     uint64_t _friendAddress; 
+    byte _friendChannel; // The channel to talk to the friend on, or CHANNEL_NONE
 };
 
+class PatternPlayer;
+
 /**
  * An open node, waiting for a controller
  */
 class OpenNode : public NightlightState { 
   public:
+    OpenNode();
     void start(Nightlight *me);
     void onTimeout(Nightlight *me);
     bool receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength);
+    template<class M> void start(M &me);
+    template<class M> void onTimeout(M &me);
+    template<class M> bool receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength);
 
     void setState_controlled(NightlightStateWithFriend *dest);
+    void setFriendList(FriendList *friendList);
+
+    unsigned int beaconInterval();
 
   private:
     NightlightStateWithFriend *_state_controlled;
+    FriendList *_friendList;
 
 };  
 
@@ -152,45 +380,335 @@ class OpenNode : public NightlightState {
  */
 class ControlledNode : public NightlightStateWithFriend { 
   public:
+    ControlledNode();
     void start(Nightlight *me);
+    void onTimeout(Nightlight *me);
     void onFinished(Nightlight *me);
     bool receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength);
+    template<class M> void start(M &me);
+    template<class M> void onTimeout(M &me);
+    template<class M> void onFinished(M &me);
+    template<class M> bool receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength);
     
     void setCommand(NightlightState *command);
+    void setPatterns(PatternPlayer *patterns);
     void setState_lostControl(NightlightState *dest);
     
   private:
     uint64_t _controller;
     NightlightState *_state_lostControl;
     NightlightState *_command;
+    PatternPlayer *_patterns; // Plays stored patterns in preference to _command, if set
+
+    template<class M> void _leave(M &me);
 };
 
 /**
- * An open node, waiting for a controller
+ * A controller, taking control of every open node it hears from.
+ * Control requests are queued and rate-limited, and nodes are released
+ * on MSG_CONTROL_STOP or when they haven't been heard from for CONTROLLER_NODE_TIMEOUT
+ * or a few of their beacon intervals, whichever is longer,
+ * in which case they are sent MSG_CONTROL_STOP so that they can be asked again.
+ *
+ * With a working channel, the controller moves its nodes onto that channel, and
+ * only visits the rendezvous channel for a discovery window every so often.
  */
 class ControllerState : public NightlightState { 
   public:
+    ControllerState();
     void start(Nightlight *me);
+    void onTimeout(Nightlight *me);
     bool receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength);
+    template<class M> void start(M &me);
+    template<class M> void onTimeout(M &me);
+    template<class M> bool receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength);
+
+    bool isControlling(byte node);
+    byte numControlling();
+
+    void setWorkingChannel(byte channel);
 
   private:
-    byte _numControlling;
-    byte _controlling[CONTROLLER_MAX_NODES];
-    byte _visible[CONTROLLER_MAX_NODES];
+    NodeSet _controlling; // Nodes under control
+    NodeSet _heard;       // Controlled nodes heard from since the last sweep
+    NodeSet _requests;    // Open nodes waiting for a MSG_CONTROL_REQUEST
+    NodeSet _releases;    // Released nodes waiting for a MSG_CONTROL_STOP
+    int _nextRequest;
+    unsigned long _nextSweep;
+    unsigned long _longestInterval; // Longest beacon interval advertised by a controlled node since the last sweep
+
+    byte _workingChannel; // Channel for talking to controlled nodes, or CHANNEL_NONE
+    unsigned long _nextDiscovery;
+    unsigned long _discoveryEnd;
+    unsigned long _nextBeacon;
+
+    void _release(byte node);
+    void _forget(byte node);
 };
 
 /**
  * A blinking light
  */
 class BlinkyLight : public NightlightState {
-  void start(Nightlight *me);
-  void onTimeout(Nightlight *me);
+  public:
+    void start(Nightlight *me);
+    void onTimeout(Nightlight *me);
+    template<class M> void start(M &me);
+    template<class M> void onTimeout(M &me);
 
   private:
     bool _on;
     unsigned long _die;
 };
 
+/**
+ * One keyframe of an animation channel, stored in PROGMEM.
+ * The channel moves from its current level to value over duration msec.
+ */
+struct Keyframe {
+  uint16_t duration;
+  byte value;
+  byte easing;
+};
+
+/**
+ * Runtime state of a single animated output
+ */
+struct AnimationChannel {
+  const Keyframe *keyframes;
+  byte numKeyframes;
+  byte pin;
+  byte loops;          // Number of times to repeat the keyframes, 0 = play once
+  unsigned int delay;  // Delay before the first keyframe, in msec
+
+  byte index;          // Keyframe currently being approached
+  byte loopsLeft;
+  long elapsed;        // Msec into the current keyframe, negative while delayed
+  uint16_t from;       // 8.8 fixed point level at the start of the current keyframe
+  uint16_t value;      // 8.8 fixed point current level
+  byte output;         // Last value written to the pin
+};
+
+/**
+ * Keyframe animation engine.
+ * Interpolates any number of channels in 8.8 fixed point once per frame, and
+ * finishes (sending MSG_COMMAND_END via ControlledNode) once every channel is done.
+ * "Level" scales the brightness, "mod-wheel" speeds up playback.
+ */
+class Animation : public NightlightState {
+  public:
+    Animation();
+    void start(Nightlight *me);
+    void onTimeout(Nightlight *me);
+    template<class M> void start(M &me);
+    template<class M> void onTimeout(M &me);
+    void setParameters(byte level, byte modWheel);
+
+    bool addChannel(byte pin, const Keyframe *keyframes, byte numKeyframes, byte loops = 0, unsigned int delay = 0);
+    void clearChannels();
+
+    void reset(unsigned long now);
+    bool update(unsigned long now);
+    byte channelOutput(byte channel);
+
+  protected:
+    virtual void writeChannel(byte pin, byte value);
+    virtual void readKeyframe(byte channel, byte index, Keyframe *keyframe);
+
+  private:
+    AnimationChannel _channels[ANIMATION_MAX_CHANNELS];
+    byte _numChannels;
+    uint16_t _speed;     // 8.8 fixed point playback speed
+    uint16_t _level;     // Brightness scale, 1-256
+    unsigned long _lastUpdate;
+
+    bool _updateChannel(AnimationChannel *channel, unsigned long step);
+};
+
+/**
+ * Fade a single pin up and back down
+ */
+class FadeLight : public Animation {
+  public:
+    FadeLight(byte pin);
+};
+
+/**
+ * Pulse a single pin three times
+ */
+class PulseLight : public Animation {
+  public:
+    PulseLight(byte pin);
+};
+
+/**
+ * Chase a pulse of light along a row of pins
+ */
+class ChaseLights : public Animation {
+  public:
+    ChaseLights(const byte *pins, byte numPins);
+};
+
+/**
+ * One pattern in a PatternStore
+ */
+struct PatternEntry {
+  byte command;
+  unsigned int page;  // First page of the record
+  uint16_t length;    // Bytes of pattern, after the header
+  uint16_t sequence;  // Higher is newer, wrapping
+};
+
+/**
+ * Patterns for commands, kept in a log of records in EEPROM.
+ *
+ * Each record starts on a page with a header (marker, command, length,
+ * sequence, CRC-16), followed by the pattern. New records are placed after the
+ * last one written, wrapping around, so writes are spread over the whole store;
+ * a record replacing an older one for the same command never overwrites it, so
+ * a failed transfer leaves the old pattern in place. The header is written
+ * last, and load() rebuilds the index from the newest valid record for each
+ * command.
+ *
+ * Patterns are streamed in with beginPattern(), writePattern() and endPattern(),
+ * a page at a time, and read back through a small cache with read().
+ */
+class PatternStore {
+  public:
+    PatternStore(unsigned int start = 0, unsigned int size = PATTERN_STORE_SIZE);
+    void load();
+
+    // Streaming writes, one pattern at a time
+    bool beginPattern(byte command, unsigned int length, uint16_t crc);
+    bool writePattern(unsigned int offset, const byte *data, byte length);
+    bool endPattern();
+    void abortPattern();
+    bool writing();
+
+    // Lookup
+    int find(byte command);
+    int select(byte command);
+    byte numPatterns();
+    const PatternEntry *entry(int index);
+    unsigned int patternAddress(int index);
+
+    byte read(unsigned int address);
+    unsigned long cacheMisses();
+
+    // Playback
+    void hold(int index);
+
+  private:
+    unsigned int _start;
+    unsigned int _numPages;
+    PatternEntry _entries[PATTERN_MAX_ENTRIES]; // Sorted by command, so banks are contiguous
+    byte _numEntries;
+    uint16_t _sequence;   // Sequence of the next record
+    unsigned int _nextPage; // Where to look for room for the next record
+    unsigned int _heldPage;  // Record being played, kept even once it is replaced
+    unsigned int _heldPages;
+
+    // Transfer in progress
+    bool _writing;
+    byte _command;
+    unsigned int _page;
+    unsigned int _length;
+    unsigned int _received;
+    uint16_t _crc;
+    uint16_t _expectedCrc;
+    byte _first[PATTERN_PAGE_SIZE];  // First page, written last as it holds the header
+    byte _buffer[PATTERN_PAGE_SIZE];
+
+    // Read cache
+    unsigned int _cacheTags[PATTERN_CACHE_LINES];
+    byte _cache[PATTERN_CACHE_LINES][PATTERN_PAGE_SIZE];
+    byte _cacheNext;
+    unsigned long _cacheMisses;
+
+    unsigned int _allocate(unsigned int pages);
+    bool _writePage(unsigned int page, const byte *data, byte length);
+    void _index(byte command, unsigned int page, uint16_t length, uint16_t sequence);
+};
+
+/**
+ * An animation read from a PatternStore as it plays, rather than from PROGMEM.
+ *
+ * A pattern is a count of channels, then for each channel: output (an index
+ * into the pins given to setPins()), loops, delay in msec (2 bytes), number of
+ * keyframes, and that many keyframes of duration in msec (2 bytes), value and
+ * easing. Multi-byte values are little-endian.
+ */
+class PatternPlayer : public Animation {
+  public:
+    PatternPlayer();
+    void setStore(PatternStore *store);
+    void setPins(const byte *pins, byte numPins);
+    bool load(byte command);
+
+  protected:
+    void readKeyframe(byte channel, byte index, Keyframe *keyframe);
+
+  private:
+    PatternStore *_store;
+    const byte *_pins;
+    byte _numPins;
+    unsigned int _keyframes[ANIMATION_MAX_CHANNELS]; // EEPROM address of each channel's keyframes
+
+    // The keyframe each channel is on, as Animation asks for it every frame
+    Keyframe _current[ANIMATION_MAX_CHANNELS];
+    byte _currentIndex[ANIMATION_MAX_CHANNELS];
+};
+
+/**
+ * Stores patterns sent with MSG_PATTERN_BEGIN/DATA/END in a PatternStore,
+ * replying with MSG_PATTERN_END. Sits low in the stack, like FriendList.
+ */
+class PatternReceiver : public NightlightState {
+  public:
+    PatternReceiver();
+    void setStore(PatternStore *store);
+    void onTimeout(Nightlight *me);
+    bool receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength);
+    template<class M> void onTimeout(M &me);
+    template<class M> bool receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength);
+
+  private:
+    PatternStore *_store;
+    int _sender;
+    byte _command;
+
+    template<class M> void _reply(M &me, int address, byte command, byte status);
+};
+
+/**
+ * Sends a pattern to a node, as fast as the telemetry budget allows, and
+ * finishes once the node has replied. Frames that can't go out straight away
+ * are sent again on the next tick, rather than deferred.
+ */
+class PatternSender : public NightlightState {
+  public:
+    PatternSender();
+    void setPattern(int address, byte command, const byte *pattern, unsigned int length);
+    void start(Nightlight *me);
+    void onTimeout(Nightlight *me);
+    bool receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength);
+    template<class M> void start(M &me);
+    template<class M> void onTimeout(M &me);
+    template<class M> bool receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength);
+    byte status();
+
+  private:
+    int _address;
+    byte _command;
+    const byte *_pattern;
+    unsigned int _length;
+    uint16_t _crc;
+    unsigned int _sent;
+    bool _begun;
+    bool _ended;
+    byte _status;
+};
+
 
 /**
  * An agent that keeps state of who is here, sending MSG_APPEAR and MSG_DISAPPEAR messages.
@@ -200,17 +718,30 @@ class FriendList : public NightlightState {
     void start(Nightlight *me);
     void onTimeout(Nightlight *me);
     bool receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength);
+    template<class M> void start(M &me);
+    template<class M> void onTimeout(M &me);
+    template<class M> bool receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength);
+
+    byte numFriends();
+    byte numNeighbours();
 
   private:
     byte _numFriends;
     byte _friends[FRIENDLIST_MAX_NODES];
-    unsigned long _timeout[FRIENDLIST_MAX_NODES];
+    unsigned int _expires[FRIENDLIST_MAX_NODES]; // In units of 256 msec
+
+    // Nodes heard when the list was full, this generation and last
+    NodeSet _untracked[2];
+    unsigned long _nextGeneration;
 };
 
 
 /////////
 
 void outputBytes(byte *data, byte len);
+byte easeProgress(byte easing, byte progress);
+byte messagePriority(byte type);
+uint16_t crc16Update(uint16_t crc, byte value);
 #endif
 
 
@@ -228,4 +759,7 @@ void sendDebugMessage(char *prefix, int address, byte myAddress, byte type, byte
 #define SEND_DEBUG_MESSAGE(a,b,c,d,e,f) ( { sendDebugMessage(a,b,c,d,e,f); } )
 #else
 #define SEND_DEBUG_MESSAGE(a,b,c,d,e,f)
-#endif
\ No newline at end of file
+#endif
+
+// The stock states' handlers, shared by Nightlight and StaticNightlight
+#include "NightlightStates.h"
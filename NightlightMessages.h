@@ -0,0 +1,260 @@
+#ifndef NightlightMessages_h
+#define NightlightMessages_h
+
+/**
+ * The wire schema of Nightlight messages.
+ *
+ * A radio frame is a 3 byte header followed by up to 29 bytes of data.
+ * Message types that carry data have a struct of bytes below, laid out exactly
+ * as on the wire, with TYPE and the LENGTH of data that must be present.
+ * Handlers read them in place with messageView(), and states send them with
+ * Nightlight::send(). Every such struct is listed once, in NightlightSchema at
+ * the end, which gives the lengths that received frames are checked against.
+ *
+ * Trailing fields that a sender may leave out are declared in MessageOptional,
+ * with the values they take then. Radio frames, and messages a node sends to
+ * itself, are rejected if they are too short and otherwise have their optional
+ * fields filled in before they reach any state, so a handler's view is never
+ * short. Serial lines are text (see NightlightLink::readSerial()), and aren't
+ * checked against the schema.
+ */
+
+// Message types
+
+// Presence notification
+const byte MSG_HELLO = 0x01; // Send this every X secondas
+const byte MSG_APPEAR = 0x02; // Generate this when new nodes appear (e.g. from FriendList)
+const byte MSG_DISAPPEAR = 0x03; // Generate this when nodes disappear (e.g. from FriendList)
+
+// Negotation remote control of devices
+const byte MSG_CONTROL_REQUEST = 0x08; // Request control, can be broadcast or unicast
+const byte MSG_CONTROL_START = 0x09; // Positive response to MSG_CONTROL_REQUEST to start remote-control
+const byte MSG_CONTROL_STOP = 0x0A; // Cancel a previous remote-control session
+
+// Sending commands to remote-controlled devices
+const byte MSG_COMMAND_SEND = 0x10; // Send a command to a remote-controlled device
+const byte MSG_COMMAND_START = 0x11; // Successfully received a remote-control command, and activity started
+const byte MSG_COMMAND_END = 0x12; // Activity finished (e.g. animation completed)
+
+// Events
+const byte MSG_EVENT = 0x18;
+
+// Operational control (from serial)
+const byte MSG_CHANGE_MODE = 0x20;
+
+// Storing animation patterns on remote-controlled devices
+const byte MSG_PATTERN_BEGIN = 0x28; // Start sending a pattern for a command
+const byte MSG_PATTERN_DATA = 0x29; // The next chunk of a pattern
+const byte MSG_PATTERN_END = 0x2A; // All of a pattern is sent; the reply says whether it was stored
+
+
+const byte CHANNEL_NONE = 0; // "No working channel": a controller and its nodes stay on the rendezvous channel
+
+
+// Frame layout
+
+/**
+ * The header of every radio frame
+ */
+struct MessageHeader {
+  byte type;
+  byte sender;     // Address offset of the sender, 1-255
+  byte dataLength; // Number of data bytes that follow, 0-29
+};
+
+const byte MESSAGE_HEADER_LENGTH = sizeof(MessageHeader);
+const byte MESSAGE_MAX_DATA = 32 - MESSAGE_HEADER_LENGTH;
+
+
+// Message data
+
+struct HelloMessage {
+  enum { TYPE = MSG_HELLO, LENGTH = 2 };
+  byte kind;     // NODE_KIND_*
+  byte interval; // Mean interval until the next MSG_HELLO, in BEACON_INTERVAL_UNITs
+};
+
+struct AppearMessage {
+  enum { TYPE = MSG_APPEAR, LENGTH = 1 };
+  byte node;
+};
+
+struct DisappearMessage {
+  enum { TYPE = MSG_DISAPPEAR, LENGTH = 1 };
+  byte node;
+};
+
+struct ControlRequestMessage {
+  enum { TYPE = MSG_CONTROL_REQUEST, LENGTH = 1 };
+  byte channel; // The controller's working channel, or CHANNEL_NONE (optional)
+};
+
+struct CommandSendMessage {
+  enum { TYPE = MSG_COMMAND_SEND, LENGTH = 3 };
+  byte command;  // High 4 bits are the bank, low 4 bits the option (optional, 0)
+  byte level;    // 0 if not applicable (optional)
+  byte modWheel; // 0 if not applicable (optional)
+};
+
+struct EventMessage {
+  enum { TYPE = MSG_EVENT, LENGTH = 2 };
+  byte event;
+  byte level;
+};
+
+struct PatternBeginMessage {
+  enum { TYPE = MSG_PATTERN_BEGIN, LENGTH = 5 };
+  byte command;    // Command that will play the pattern
+  byte lengthLow;  // Length of the pattern in bytes
+  byte lengthHigh;
+  byte crcLow;     // CRC-16 of the pattern, see crc16Update()
+  byte crcHigh;
+};
+
+struct PatternDataMessage {
+  enum { TYPE = MSG_PATTERN_DATA, LENGTH = 2 };
+  byte offsetLow;  // Offset of this chunk in the pattern; chunks must arrive in order
+  byte offsetHigh;
+  // Followed by up to PATTERN_CHUNK_LENGTH bytes of the pattern
+};
+
+struct PatternEndMessage {
+  enum { TYPE = MSG_PATTERN_END, LENGTH = 2 };
+  byte command;
+  byte status;     // PATTERN_* in replies, 0 from the sender
+};
+
+const byte PATTERN_CHUNK_LENGTH = MESSAGE_MAX_DATA - PatternDataMessage::LENGTH;
+
+// Status of a pattern transfer, in MSG_PATTERN_END replies
+const byte PATTERN_OK = 0;
+const byte PATTERN_FULL = 1;      // No room in the store
+const byte PATTERN_BAD_DATA = 2;  // Chunk out of order, CRC mismatch, or a failed write
+const byte PATTERN_BUSY = 3;      // Another transfer is in progress
+
+/**
+ * Read-only view of a message's data in place, or 0 if it isn't a T or is too short
+ */
+template<class T> const T *messageView(byte type, const byte *data, byte dataLength) {
+  static_assert(sizeof(T) == T::LENGTH, "message data must be a struct of bytes");
+  static_assert(T::LENGTH <= MESSAGE_MAX_DATA, "message data doesn't fit in a frame");
+
+  if(type != T::TYPE || dataLength < T::LENGTH) return 0;
+  return (const T *)data;
+}
+
+/**
+ * Trailing fields of a T that a sender may leave out: a frame must carry at
+ * least MIN_LENGTH bytes, and the rest are filled in from defaults().
+ * Messages have none unless specialised here.
+ */
+template<class T> struct MessageOptional {
+  enum { MIN_LENGTH = T::LENGTH };
+  static T defaults() {
+    return T();
+  }
+};
+
+template<> struct MessageOptional<ControlRequestMessage> {
+  enum { MIN_LENGTH = 0 };
+  static ControlRequestMessage defaults() {
+    ControlRequestMessage message = { CHANNEL_NONE };
+    return message;
+  }
+};
+
+template<> struct MessageOptional<CommandSendMessage> {
+  enum { MIN_LENGTH = 0 };
+  static CommandSendMessage defaults() {
+    CommandSendMessage message = { 0, 0, 0 };
+    return message;
+  }
+};
+
+/**
+ * Lengths of a list of message structs, looked up by type. Types that aren't
+ * listed carry no fixed data.
+ */
+template<class... Messages> struct MessageSchema;
+
+template<>
+struct MessageSchema<> {
+  static byte minLength(byte type) { return 0; }
+  static byte length(byte type) { return 0; }
+  static void fill(byte type, byte *data, byte dataLength) {}
+};
+
+template<class T, class... Tail>
+struct MessageSchema<T, Tail...> {
+  static_assert(sizeof(T) == T::LENGTH, "message data must be a struct of bytes");
+  static_assert(T::LENGTH <= MESSAGE_MAX_DATA, "message data doesn't fit in a frame");
+  static_assert((int)MessageOptional<T>::MIN_LENGTH <= (int)T::LENGTH, "optional fields must be part of the message");
+
+  static byte minLength(byte type) {
+    return type == T::TYPE ? (byte)MessageOptional<T>::MIN_LENGTH : MessageSchema<Tail...>::minLength(type);
+  }
+
+  static byte length(byte type) {
+    return type == T::TYPE ? (byte)T::LENGTH : MessageSchema<Tail...>::length(type);
+  }
+
+  // Write the defaults of the fields after the first dataLength bytes
+  static void fill(byte type, byte *data, byte dataLength) {
+    if(type != T::TYPE) {
+      MessageSchema<Tail...>::fill(type, data, dataLength);
+      return;
+    }
+
+    T defaults = MessageOptional<T>::defaults();
+    if(dataLength < T::LENGTH) {
+      memcpy(data + dataLength, (byte *)&defaults + dataLength, T::LENGTH - dataLength);
+    }
+  }
+};
+
+/**
+ * Every message type that carries data
+ */
+typedef MessageSchema<
+  HelloMessage,
+  AppearMessage,
+  DisappearMessage,
+  ControlRequestMessage,
+  CommandSendMessage,
+  EventMessage,
+  PatternBeginMessage,
+  PatternDataMessage,
+  PatternEndMessage
+> NightlightSchema;
+
+/**
+ * Number of data bytes a frame of this type must carry
+ */
+inline byte messageMinLength(byte type) {
+  return NightlightSchema::minLength(type);
+}
+
+/**
+ * Number of data bytes in a whole message of this type, 0 if it has no struct
+ */
+inline byte messageLength(byte type) {
+  return NightlightSchema::length(type);
+}
+
+/**
+ * Check a received message against the schema, and fill in any optional fields
+ * it left out. data must have room for MESSAGE_MAX_DATA bytes.
+ * Returns false if the message is too short to be a valid one of its type.
+ */
+inline bool messageComplete(byte type, byte *data, byte *dataLength) {
+  if(*dataLength < messageMinLength(type)) return false;
+
+  byte length = messageLength(type);
+  if(*dataLength < length) {
+    NightlightSchema::fill(type, data, *dataLength);
+    *dataLength = length;
+  }
+  return true;
+}
+
+#endif
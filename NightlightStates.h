@@ -0,0 +1,576 @@
+#ifndef NightlightStates_h
+#define NightlightStates_h
+
+/**
+ * Handlers of the stock states, included at the end of Nightlight.h.
+ *
+ * They are templates on the machine, so that the same code runs on a
+ * Nightlight, where the virtual handlers in Nightlight.cpp forward to them,
+ * and on a StaticNightlight, which calls them directly. A machine provides
+ * send(), sendMessage(), sendNow(), setChannel(), channel(), myAddress(), and
+ * pushState()/removeState() taking the address of a state; StaticNightlight
+ * also provides finishState() for NightlightState::finish().
+ */
+
+/**
+ * On a StaticNightlight, which looks up both states by address
+ */
+template<class M> void NightlightState::finish(M &me)
+{
+  me.finishState(this, _notifyFinished);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Send the first beacon at a random phase, so that nodes booted together don't beacon in lockstep
+ */
+template<class M> void OpenNode::start(M &me)
+{
+  this->setTimeout(random(BEACON_MIN_INTERVAL));
+}
+
+template<class M> void OpenNode::onTimeout(M &me)
+{
+  unsigned int interval = beaconInterval();
+  HelloMessage hello = { NODE_KIND_OPEN, (byte)(interval / BEACON_INTERVAL_UNIT) };
+  me.send(0, hello);
+
+  // Jitter the next beacon by +/- 50%
+  this->setTimeout(interval / 2 + random(interval));
+}
+
+template<class M> bool OpenNode::receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength)
+{
+  if(type == MSG_CONTROL_REQUEST) {
+    // Data is the controller's working channel; a serial controller has none
+    const ControlRequestMessage *request = messageView<ControlRequestMessage>(type, data, dataLength);
+    _state_controlled->setFriend(sender, sender == -1 ? CHANNEL_NONE : request->channel);
+    me.pushState(_state_controlled);
+    return true;
+  }
+
+  NightlightState::receiveMessage(me, sender, type, data, dataLength);
+
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+template<class M> void ControlledNode::start(M &me)
+{
+  // Accept on the channel the request came in on, then join the controller's channel
+  me.sendMessage(_friendAddress, MSG_CONTROL_START, 0, 0);
+  if(_friendChannel != CHANNEL_NONE) me.setChannel(_friendChannel);
+  this->setTimeout(CONTROLLER_LOST_TIMEOUT);
+}
+
+/**
+ * The controller has gone quiet, e.g. it released us but the MSG_CONTROL_STOP was lost.
+ * Tell it in case it can still hear us, then go back to being open.
+ */
+template<class M> void ControlledNode::onTimeout(M &me)
+{
+  me.sendMessage(_friendAddress, MSG_CONTROL_STOP, 0, 0);
+  _leave(me);
+}
+
+/**
+ * Stop any command that is playing, and return to the rendezvous channel and
+ * the open node underneath
+ */
+template<class M> void ControlledNode::_leave(M &me)
+{
+  me.removeState(_command);
+  if(_patterns) me.removeState(_patterns);
+  me.setChannel(CHANNEL_RENDEZVOUS);
+  me.removeState(this);
+}
+
+template<class M> void ControlledNode::onFinished(M &me)
+{
+  me.sendMessage(_friendAddress, MSG_COMMAND_END, 0, 0);
+}
+
+template<class M> bool ControlledNode::receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength)
+{
+  // Anything from the controller, including its beacons, shows it's still there
+  if(sender > 0 && sender == _friendAddress) this->setTimeout(CONTROLLER_LOST_TIMEOUT);
+
+  const CommandSendMessage *command = messageView<CommandSendMessage>(type, data, dataLength);
+  if(command && sender == _friendAddress) {
+    me.sendMessage(_friendAddress, MSG_COMMAND_START, 0, 0);
+
+    NightlightState *state = _command;
+    if(_patterns && _patterns->load(command->command)) state = _patterns;
+    state->setParameters(command->level, command->modWheel);
+
+    // A new command replaces the one that is playing, stored pattern or not
+    me.removeState(_command);
+    if(_patterns) me.removeState(_patterns);
+    me.pushState(state);
+    state->notifyFinished(this);
+    return true;
+  }
+
+  // The controller has let go
+  if(type == MSG_CONTROL_STOP && sender == _friendAddress) {
+    _leave(me);
+    return true;
+  }
+
+  // Our controller has lost track of us, e.g. after a restart; accept again, as in start()
+  if(type == MSG_CONTROL_REQUEST && sender == _friendAddress) {
+    const ControlRequestMessage *request = messageView<ControlRequestMessage>(type, data, dataLength);
+    _friendChannel = sender == -1 ? CHANNEL_NONE : request->channel;
+    me.sendMessage(_friendAddress, MSG_CONTROL_START, 0, 0);
+    if(_friendChannel != CHANNEL_NONE) me.setChannel(_friendChannel);
+    return true;
+  }
+
+  // Prevent the event from bubbling
+  if(type == MSG_CONTROL_REQUEST) return true;
+
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+template<class M> void ControllerState::start(M &me)
+{
+  _controlling.clear();
+  _heard.clear();
+  _requests.clear();
+  _releases.clear();
+  _nextRequest = 0;
+  _nextSweep = millis() + CONTROLLER_NODE_TIMEOUT;
+  _longestInterval = 0;
+
+  // Start with discovery
+  _nextDiscovery = millis() + CONTROLLER_DISCOVERY_PERIOD;
+  _discoveryEnd = millis() + CONTROLLER_DISCOVERY_WINDOW;
+  _nextBeacon = millis() + CONTROLLER_BEACON_INTERVAL;
+  me.setChannel(CHANNEL_RENDEZVOUS);
+
+  this->setTimeout(CONTROLLER_REQUEST_INTERVAL);
+}
+
+/**
+ * Send a limited number of queued control requests, and release silent nodes
+ */
+template<class M> void ControllerState::onTimeout(M &me)
+{
+  byte sent;
+  int node;
+  unsigned long m = millis();
+
+  // Hop between the working channel and discovery windows on the rendezvous channel
+  if(_workingChannel != CHANNEL_NONE) {
+    if(me.channel() == CHANNEL_RENDEZVOUS && _discoveryEnd < m) {
+      me.setChannel(_workingChannel);
+
+    } else if(me.channel() != CHANNEL_RENDEZVOUS && _nextDiscovery < m) {
+      me.setChannel(CHANNEL_RENDEZVOUS);
+      _discoveryEnd = m + CONTROLLER_DISCOVERY_WINDOW;
+      _nextDiscovery = m + CONTROLLER_DISCOVERY_PERIOD;
+    }
+  }
+
+  // Let controlled nodes know that we're still here, on the channel they are on
+  bool onNodesChannel = _workingChannel == CHANNEL_NONE || me.channel() == _workingChannel;
+  if(onNodesChannel && _nextBeacon < m && _controlling.count() > 0) {
+    HelloMessage hello = { NODE_KIND_CONTROLLER, CONTROLLER_BEACON_INTERVAL / BEACON_INTERVAL_UNIT };
+    me.send(0, hello);
+    _nextBeacon = m + CONTROLLER_BEACON_INTERVAL;
+  }
+
+  // Tell released nodes first, on the channel they are on; a sweep can release
+  // many at once, so they share the rate limit with requests
+  for(sent = 0; sent < CONTROLLER_REQUESTS_PER_INTERVAL && onNodesChannel; sent++) {
+    node = _releases.next(-1);
+    if(node < 0) break;
+
+    _releases.remove(node);
+    me.sendMessage(node, MSG_CONTROL_STOP, 0, 0);
+  }
+
+  // Round-robin through the queue, so that every node gets a turn
+  for(; sent < CONTROLLER_REQUESTS_PER_INTERVAL && me.channel() == CHANNEL_RENDEZVOUS; sent++) {
+    node = _requests.next(_nextRequest);
+    if(node < 0) node = _requests.next(-1);
+    if(node < 0) break;
+
+    _requests.remove(node);
+    _nextRequest = node;
+    if(_workingChannel != CHANNEL_NONE) {
+      ControlRequestMessage request = { _workingChannel };
+      me.send(node, request);
+    } else {
+      me.sendMessage(node, MSG_CONTROL_REQUEST, 0, 0);
+    }
+  }
+
+  if(_nextSweep < m) {
+    for(node = _controlling.next(-1); node >= 0; node = _controlling.next(node)) {
+      if(!_heard.contains(node)) _release(node);
+    }
+    _heard.clear();
+
+    // Wait for a few of the longest beacon intervals advertised, as FriendList does,
+    // since they grow with the size of the swarm
+    unsigned long timeout = _longestInterval * BEACON_EXPIRY_FACTOR;
+    if(timeout < CONTROLLER_NODE_TIMEOUT) timeout = CONTROLLER_NODE_TIMEOUT;
+    _nextSweep = m + timeout;
+    _longestInterval = 0;
+  }
+
+  this->setTimeout(CONTROLLER_REQUEST_INTERVAL);
+}
+
+template<class M> bool ControllerState::receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength)
+{
+  int node;
+
+  if(type == MSG_COMMAND_SEND && sender == -1) {
+    // Serial data is up to 3 hex pairs: command, level, mod-wheel
+    CommandSendMessage command = { 0, 0, 0 };
+    byte *fields = (byte *)&command;
+    byte i;
+    for(i=0; i<CommandSendMessage::LENGTH && i*3+1 < dataLength; i++) {
+      fields[i] = hexPair((char *)data + i*3);
+    }
+
+    if(_controlling.count() > 0) {
+      // Cut any discovery window short
+      if(_workingChannel != CHANNEL_NONE) me.setChannel(_workingChannel);
+
+      Serial.print("00 Sending a beat to ");
+      Serial.print(_controlling.count());
+      Serial.println(" nodes");
+      for(node = _controlling.next(-1); node >= 0; node = _controlling.next(node)) {
+        me.send(node, command);
+      }
+      
+    } else {
+      Serial.println("00 No nodes currently under control");
+    }
+    return true;
+  }
+
+  // FriendList has given up on a node
+  const DisappearMessage *gone = messageView<DisappearMessage>(type, data, dataLength);
+  if(gone && sender == me.myAddress()) {
+    if(_controlling.contains(gone->node)) _release(gone->node);
+    return false;
+  }
+
+  if(sender <= 0 || sender == me.myAddress()) {
+    return NightlightState::receiveMessage(me, sender, type, data, dataLength);
+  }
+
+  // A controlled node heard on the rendezvous channel has left the working channel,
+  // e.g. after losing touch with us; ask it again
+  if(_controlling.contains(sender) && _workingChannel != CHANNEL_NONE && me.channel() == CHANNEL_RENDEZVOUS && type != MSG_CONTROL_START) {
+    _forget(sender);
+  }
+
+  // Any message from a controlled node shows that it's still there
+  if(_controlling.contains(sender)) {
+    _heard.add(sender);
+  }
+
+  // Queue a control request; let the message bubble on to e.g. FriendList
+  if(type == MSG_HELLO) {
+    const HelloMessage *hello = messageView<HelloMessage>(type, data, dataLength);
+    if(_controlling.contains(sender)) {
+      unsigned long interval = hello && hello->interval ? (unsigned long)hello->interval * BEACON_INTERVAL_UNIT : BEACON_MIN_INTERVAL;
+      if(interval > _longestInterval) _longestInterval = interval;
+
+    } else if(me.channel() == CHANNEL_RENDEZVOUS && !(hello && hello->kind == NODE_KIND_CONTROLLER)) {
+      _requests.add(sender);
+    }
+    return false;
+  }    
+
+  if(type == MSG_CONTROL_START) {
+    _controlling.add(sender);
+    _heard.add(sender);
+    _requests.remove(sender);
+    _releases.remove(sender);
+    return true;
+  }
+
+  if(type == MSG_CONTROL_STOP) {
+    _forget(sender);
+    return true;
+  }
+
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+template<class M> void BlinkyLight::start(M &me)
+{
+  pinMode(2, OUTPUT);
+
+  _on = true;
+  _die = millis() + 2000;
+
+  this->onTimeout(me);
+}
+
+template<class M> void BlinkyLight::onTimeout(M &me)
+{
+  digitalWrite(2, _on);
+  _on = !_on;
+
+  if(millis() > _die) {
+    digitalWrite(2, false);
+    this->finish(me);
+
+  } else { 
+   this->setTimeout(100);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+template<class M> void Animation::start(M &me)
+{
+  byte i;
+  for(i=0; i<_numChannels; i++) {
+    pinMode(_channels[i].pin, OUTPUT);
+  }
+
+  reset(millis());
+  this->setTimeout(FRAME_LENGTH);
+}
+
+template<class M> void Animation::onTimeout(M &me)
+{
+  if(update(millis())) {
+    this->setTimeout(FRAME_LENGTH);
+  } else {
+    this->finish(me);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The sender has gone quiet
+ */
+template<class M> void PatternReceiver::onTimeout(M &me)
+{
+  _store->abortPattern();
+  _sender = -1;
+}
+
+template<class M> bool PatternReceiver::receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength)
+{
+  // Patterns only come over the radio
+  if(!_store || sender <= 0) return false;
+
+  const PatternBeginMessage *begin = messageView<PatternBeginMessage>(type, data, dataLength);
+  if(begin) {
+    if(_store->writing() && sender != _sender) {
+      _reply(me, sender, begin->command, PATTERN_BUSY);
+      return true;
+    }
+
+    unsigned int length = begin->lengthLow | (begin->lengthHigh << 8);
+    uint16_t crc = begin->crcLow | (begin->crcHigh << 8);
+    if(!_store->beginPattern(begin->command, length, crc)) {
+      _sender = -1;
+      _reply(me, sender, begin->command, PATTERN_FULL);
+      return true;
+    }
+
+    _sender = sender;
+    _command = begin->command;
+    this->setTimeout(PATTERN_TRANSFER_TIMEOUT);
+    return true;
+  }
+
+  if(sender != _sender || !_store->writing()) return false;
+
+  const PatternDataMessage *chunk = messageView<PatternDataMessage>(type, data, dataLength);
+  if(chunk) {
+    unsigned int offset = chunk->offsetLow | (chunk->offsetHigh << 8);
+    if(_store->writePattern(offset, data + PatternDataMessage::LENGTH, dataLength - PatternDataMessage::LENGTH)) {
+      this->setTimeout(PATTERN_TRANSFER_TIMEOUT);
+    } else {
+      _reply(me, sender, _command, PATTERN_BAD_DATA);
+      _sender = -1;
+      _timeout = 0;
+    }
+    return true;
+  }
+
+  if(messageView<PatternEndMessage>(type, data, dataLength)) {
+    _reply(me, sender, _command, _store->endPattern() ? PATTERN_OK : PATTERN_BAD_DATA);
+    _sender = -1;
+    _timeout = 0;
+    return true;
+  }
+
+  return false;
+}
+
+template<class M> void PatternReceiver::_reply(M &me, int address, byte command, byte status)
+{
+  PatternEndMessage reply = { command, status };
+  me.send(address, reply);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+template<class M> void PatternSender::start(M &me)
+{
+  unsigned int i;
+  _crc = 0xFFFF;
+  for(i=0; i<_length; i++) {
+    _crc = crc16Update(_crc, _pattern[i]);
+  }
+
+  _sent = 0;
+  _begun = false;
+  _ended = false;
+  _status = PATTERN_PENDING;
+  this->setTimeout(1);
+}
+
+template<class M> void PatternSender::onTimeout(M &me)
+{
+  byte packet[MESSAGE_MAX_DATA];
+  byte length;
+
+  if(_ended) {
+    _status = PATTERN_TIMEOUT;
+    this->finish(me);
+    return;
+  }
+
+  if(!_begun) {
+    PatternBeginMessage begin = { _command, (byte)_length, (byte)(_length >> 8), (byte)_crc, (byte)(_crc >> 8) };
+    _begun = me.sendNow(_address, begin);
+  }
+
+  // Chunks must arrive in order, so one that can't be sent now is sent again
+  // next tick, rather than deferred where it could be dropped
+  while(_begun && _sent < _length) {
+    length = _length - _sent < PATTERN_CHUNK_LENGTH ? _length - _sent : PATTERN_CHUNK_LENGTH;
+    packet[0] = _sent;
+    packet[1] = _sent >> 8;
+    memcpy(packet + PatternDataMessage::LENGTH, _pattern + _sent, length);
+    if(!me.sendNow(_address, MSG_PATTERN_DATA, packet, PatternDataMessage::LENGTH + length)) break;
+    _sent += length;
+  }
+
+  PatternEndMessage end = { _command, 0 };
+  if(!_begun || _sent < _length || !me.sendNow(_address, end)) {
+    this->setTimeout(BUDGET_REFILL_PERIOD);
+    return;
+  }
+
+  _ended = true;
+  this->setTimeout(PATTERN_TRANSFER_TIMEOUT);
+}
+
+template<class M> bool PatternSender::receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength)
+{
+  const PatternEndMessage *reply = messageView<PatternEndMessage>(type, data, dataLength);
+  if(reply && sender == _address) {
+    _status = reply->status;
+    this->finish(me);
+    return true;
+  }
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Kick off the timeout
+ */
+template<class M> void FriendList::start(M &me)
+{
+  _numFriends = 0;
+  _untracked[0].clear();
+  _untracked[1].clear();
+  _nextGeneration = millis() + FRIENDLIST_GENERATION;
+  this->setTimeout(1000);
+}
+
+template<class M> bool FriendList::receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength)
+{
+  int i;
+  if(type == MSG_HELLO && sender > 0) {
+    // Expire after a few of the sender's advertised beacon intervals
+    const HelloMessage *hello = messageView<HelloMessage>(type, data, dataLength);
+    unsigned long interval = BEACON_MIN_INTERVAL;
+    if(hello && hello->interval) interval = (unsigned long)hello->interval * BEACON_INTERVAL_UNIT;
+    unsigned int expires = (millis() + interval * BEACON_EXPIRY_FACTOR) >> 8;
+
+    for(i=0; i<_numFriends; i++) {
+      // Match, push out time
+      if(_friends[i] == sender) {
+        _expires[i] = expires;
+        return true;
+      }
+    }
+
+    // No room to track this node; still count it as a neighbour
+    if(_numFriends >= FRIENDLIST_MAX_NODES) {
+      _untracked[0].add(sender);
+      return true;
+    }
+
+    // No match, add to list, send appear message
+    _friends[_numFriends] = sender;
+    _expires[_numFriends] = expires;
+    _numFriends++;
+
+    AppearMessage appear = { (byte)sender };
+    me.send(me.myAddress(), appear);
+    return true;
+  }
+
+  return false;
+}
+
+/**
+ * Cleanup disappeared notes every second
+ */
+template<class M> void FriendList::onTimeout(M &me)
+{
+  int i, j;
+  unsigned long m = millis();
+  unsigned int now = m >> 8;
+  for(i=0; i<_numFriends; i++) {
+    // Timeout reached, send a disappear mesasge
+    if((int)(_expires[i] - now) < 0) {
+      DisappearMessage disappear = { _friends[i] };
+      me.send(me.myAddress(), disappear);
+
+      // Remove element from array
+      for(j=i; j<_numFriends-1; j++) {
+        _friends[j] = _friends[j+1];
+        _expires[j] = _expires[j+1];
+      }
+      i--;
+      _numFriends--;
+    }
+  }
+
+  if(_nextGeneration < m) {
+    _untracked[1] = _untracked[0];
+    _untracked[0].clear();
+    _nextGeneration = m + FRIENDLIST_GENERATION;
+  }
+
+  this->setTimeout(1000);
+}
+
+#endif
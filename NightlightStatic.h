@@ -0,0 +1,363 @@
+#ifndef NightlightStatic_h
+#define NightlightStatic_h
+
+#include "Nightlight.h"
+
+/**
+ * Compile-time alternative to Nightlight, for firmware where the set of states is fixed.
+ *
+ *   class Blinky : public StaticState<Blinky> {
+ *     public:
+ *       template<class M> void start(M &me) { setTimeout(100); }
+ *       template<class M> void onTimeout(M &me) { finish(me); }
+ *   };
+ *
+ *   StaticNightlight<Listener, Blinky> nightlight(0x26B8259100LL);
+ *   nightlight.pushState<Blinky>();
+ *
+ * States are stored inside the StaticNightlight and identified by type. Dispatch
+ * is resolved at compile time, so there are no virtual calls, vtables, or
+ * per-state Map; handlers a state doesn't define fall back to the empty ones in
+ * StaticState and are inlined away.
+ *
+ * The stack behaves exactly like Nightlight's pushState/removeState/changeState.
+ * Radio and serial I/O is delegated to a NightlightLink, the transport that
+ * Nightlight is built on, so there is no virtual state stack behind it.
+ *
+ * The stock states (FriendList, OpenNode, ControlledNode, ControllerState, the
+ * light and pattern states) can be used too, running the same handlers as on
+ * a Nightlight (see NightlightStates.h):
+ *
+ *   StaticNightlight<FriendList, OpenNode, ControlledNode, BlinkyLight> node(0x26B8259100LL);
+ *   node.state<OpenNode>().setState_controlled(&node.state<ControlledNode>());
+ *   node.state<ControlledNode>().setCommand(&node.state<BlinkyLight>());
+ *
+ * They refer to each other by address, and still carry NightlightState's
+ * vtable and serial command Map, so firmware short of RAM writes its own
+ * StaticStates instead.
+ */
+
+const byte STATIC_NO_STATE = 0xFF;
+
+/**
+ * Base class for states of a StaticNightlight, with default handlers
+ */
+template<class Derived>
+class StaticState {
+  public:
+    StaticState() : _timeout(0) {}
+
+    // Event handlers, hidden by the same names in Derived
+    template<class M> void start(M &me) {}
+    template<class M> void onTimeout(M &me) {}
+    template<class M> void onFinished(M &me) {}
+    template<class M> bool receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength) {
+      return false;
+    }
+
+    template<class M> void finish(M &me) {
+      me.template finishState<Derived>();
+    }
+
+    void setTimeout(unsigned long timeout) {
+      _timeout = millis() + timeout;
+    }
+
+    unsigned long _timeout;
+};
+
+/**
+ * Index of T within a list of state types
+ */
+template<class T, class... States> struct StaticIndexOf;
+
+template<class T, class... Tail>
+struct StaticIndexOf<T, T, Tail...> {
+  enum { value = 0 };
+};
+
+template<class T, class Head, class... Tail>
+struct StaticIndexOf<T, Head, Tail...> {
+  enum { value = 1 + StaticIndexOf<T, Tail...>::value };
+};
+
+template<class T> struct StaticTag {};
+
+/**
+ * Storage for the states, with dispatch by index unrolled at compile time
+ */
+template<class... States> struct StaticStateList;
+
+template<>
+struct StaticStateList<> {
+  byte indexOf(const void *state, byte index) {
+    return STATIC_NO_STATE;
+  }
+
+  template<class M> void start(M &me, byte index) {}
+  template<class M> void onFinished(M &me, byte index) {}
+  template<class M> void checkTimeout(M &me, byte index, unsigned long m) {}
+  template<class M> bool receiveMessage(M &me, byte index, int sender, byte type, byte *data, byte dataLength) {
+    return false;
+  }
+};
+
+template<class Head, class... Tail>
+struct StaticStateList<Head, Tail...> {
+  Head head;
+  StaticStateList<Tail...> tail;
+
+  Head &get(StaticTag<Head>) {
+    return head;
+  }
+  template<class T> T &get(StaticTag<T> tag) {
+    return tail.get(tag);
+  }
+
+  byte indexOf(const void *state, byte index) {
+    if(state == &head) return index;
+    return tail.indexOf(state, index + 1);
+  }
+
+  template<class M> void start(M &me, byte index) {
+    if(index == 0) {
+      head._timeout = 0;
+      head.start(me);
+    } else {
+      tail.start(me, index - 1);
+    }
+  }
+
+  template<class M> void onFinished(M &me, byte index) {
+    if(index == 0) head.onFinished(me);
+    else tail.onFinished(me, index - 1);
+  }
+
+  template<class M> void checkTimeout(M &me, byte index, unsigned long m) {
+    if(index == 0) {
+      if(head._timeout && head._timeout < m) {
+        head._timeout = 0;
+        head.onTimeout(me);
+      }
+    } else {
+      tail.checkTimeout(me, index - 1, m);
+    }
+  }
+
+  template<class M> bool receiveMessage(M &me, byte index, int sender, byte type, byte *data, byte dataLength) {
+    if(index == 0) return head.receiveMessage(me, sender, type, data, dataLength);
+    return tail.receiveMessage(me, index - 1, sender, type, data, dataLength);
+  }
+};
+
+template<class... States>
+class StaticNightlight {
+  public:
+    StaticNightlight(uint64_t broadcast) : _link(broadcast) {
+      _numStates = 0;
+      for(byte i=0; i<sizeof...(States); i++) _notify[i] = STATIC_NO_STATE;
+    }
+
+    void setup() {
+      _link.setup();
+    }
+
+    void enableSerial() {
+      _link.enableSerial();
+    }
+
+    void loop() {
+      NightlightMessage message;
+
+      // Check for radio messages
+      if(_link.readRadio(&message)) {
+        _dispatch(message.sender, message.type, message.data, message.dataLength);
+      }
+
+      // Check for serial messages
+      if(_link.readSerial(&message)) {
+        _dispatch(message.sender, message.type, message.data, message.dataLength);
+      }
+
+      // Send deferred radio frames that are now within budget
+      _link.transmitQueued();
+
+      // Check for timeouts
+      byte i;
+      unsigned long m = millis();
+      for(i=0; i<_numStates; i++) {
+        _states.checkTimeout(*this, _stack[i], m);
+      }
+    }
+
+    /**
+     * Send a message to an address, as Nightlight::sendMessage
+     */
+    void sendMessage(int address, byte type, byte *data, byte dataLength) {
+      if(address == _link._myAddressOffset) {
+        if(dataLength < messageLength(type)) {
+          byte complete[MESSAGE_MAX_DATA];
+          memcpy(complete, data, dataLength);
+          if(messageComplete(type, complete, &dataLength)) _dispatch(_link._myAddressOffset, type, complete, dataLength);
+        } else {
+          _dispatch(_link._myAddressOffset, type, data, dataLength);
+        }
+      } else {
+        _link.transmit(address, type, data, dataLength);
+      }
+    }
+
+    /**
+     * Send a message described in NightlightMessages.h
+     */
+    template<class T> void send(int address, const T &message) {
+      sendMessage(address, T::TYPE, (byte *)&message, T::LENGTH);
+    }
+
+    /**
+     * Send a message only if it can go out straight away, as Nightlight::sendNow
+     */
+    bool sendNow(int address, byte type, byte *data, byte dataLength) {
+      if(address != _link._myAddressOffset && !_link.canTransmit(address, type, dataLength)) return false;
+
+      sendMessage(address, type, data, dataLength);
+      return true;
+    }
+    template<class T> bool sendNow(int address, const T &message) {
+      return sendNow(address, T::TYPE, (byte *)&message, T::LENGTH);
+    }
+
+    /**
+     * The instance of a state, e.g. for configuration before it is pushed
+     */
+    template<class T> T &state() {
+      return _states.get(StaticTag<T>());
+    }
+
+    /**
+     * Push a new state onto the stack
+     */
+    template<class T> void pushState() {
+      _push(StaticIndexOf<T, States...>::value);
+    }
+
+    /**
+     * Remove a state from the stack (needn't be at the top of the stack)
+     */
+    template<class T> void removeState() {
+      _remove(StaticIndexOf<T, States...>::value);
+    }
+
+    /**
+     * Push or remove one of the states by its address, as the stock states do.
+     * Addresses that aren't states of this machine are ignored.
+     */
+    void pushState(const void *state) {
+      byte index = _states.indexOf(state, 0);
+      if(index != STATIC_NO_STATE) _push(index);
+    }
+
+    void removeState(const void *state) {
+      byte index = _states.indexOf(state, 0);
+      if(index != STATIC_NO_STATE) _remove(index);
+    }
+
+    /**
+     * Switch from one state to another
+     */
+    template<class From, class To> void changeState() {
+      removeState<From>();
+      pushState<To>();
+    }
+
+    /**
+     * When From finishes, To->onFinished() will be called
+     */
+    template<class From, class To> void notifyFinished() {
+      _notify[StaticIndexOf<From, States...>::value] = StaticIndexOf<To, States...>::value;
+    }
+
+    /**
+     * Called by StaticState::finish()
+     */
+    template<class T> void finishState() {
+      removeState<T>();
+
+      byte notify = _notify[StaticIndexOf<T, States...>::value];
+      if(notify != STATIC_NO_STATE) {
+        _states.onFinished(*this, notify);
+      }
+    }
+
+    /**
+     * Called by NightlightState::finish(), with the state set by its notifyFinished()
+     */
+    void finishState(const void *state, const void *notify) {
+      byte index = _states.indexOf(state, 0);
+      if(index == STATIC_NO_STATE) return;
+      _remove(index);
+
+      byte notifyIndex = notify ? _states.indexOf(notify, 0) : _notify[index];
+      if(notifyIndex != STATIC_NO_STATE) {
+        _states.onFinished(*this, notifyIndex);
+      }
+    }
+
+    byte numStates() {
+      return _numStates;
+    }
+
+    void setChannel(byte channel) {
+      _link.setChannel(channel);
+    }
+
+    byte channel() {
+      return _link.channel();
+    }
+
+    byte myAddress() {
+      return _link._myAddressOffset;
+    }
+
+    NightlightLink &link() {
+      return _link;
+    }
+
+  private:
+    NightlightLink _link;
+    StaticStateList<States...> _states;
+    byte _stack[STATE_STACK_SIZE];
+    byte _numStates;
+    byte _notify[sizeof...(States)];
+
+    void _push(byte index) {
+      // No room; states must be removed before others are pushed
+      if(_numStates >= STATE_STACK_SIZE) return;
+
+      _stack[_numStates] = index;
+      _numStates++;
+      _states.start(*this, index);
+    }
+
+    void _remove(byte index) {
+      byte i;
+      for(i=0; i<_numStates; i++) {
+        if(_stack[i] == index) break;
+      }
+      if(i == _numStates) return;
+
+      for(; i<_numStates-1; i++) {
+        _stack[i] = _stack[i+1];
+      }
+      _numStates--;
+    }
+
+    void _dispatch(int sender, byte type, byte *data, byte dataLength) {
+      int i;
+      for(i=_numStates-1; i>=0; i--) {
+        if(_states.receiveMessage(*this, _stack[i], sender, type, data, dataLength)) break;
+      }
+    }
+};
+
+#endif
@@ -0,0 +1,87 @@
+// Generated by tools/gentables.py - do not edit by hand
+
+#ifndef NightlightTables_h
+#define NightlightTables_h
+
+// Gamma correction (2.8) from linear brightness to PWM duty
+const byte GAMMA_TABLE[256] PROGMEM = {
+    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,
+    1,  1,  1,  1,  1,  1,  1,  1,  1,  2,  2,  2,  2,  2,  2,  2,
+    2,  3,  3,  3,  3,  3,  3,  3,  4,  4,  4,  4,  4,  5,  5,  5,
+    5,  6,  6,  6,  6,  7,  7,  7,  7,  8,  8,  8,  9,  9,  9, 10,
+   10, 10, 11, 11, 11, 12, 12, 13, 13, 13, 14, 14, 15, 15, 16, 16,
+   17, 17, 18, 18, 19, 19, 20, 20, 21, 21, 22, 22, 23, 24, 24, 25,
+   25, 26, 27, 27, 28, 29, 29, 30, 31, 32, 32, 33, 34, 35, 35, 36,
+   37, 38, 39, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 50,
+   51, 52, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 66, 67, 68,
+   69, 70, 72, 73, 74, 75, 77, 78, 79, 81, 82, 83, 85, 86, 87, 89,
+   90, 92, 93, 95, 96, 98, 99,101,102,104,105,107,109,110,112,114,
+  115,117,119,120,122,124,126,127,129,131,133,135,137,138,140,142,
+  144,146,148,150,152,154,156,158,160,162,164,167,169,171,173,175,
+  177,180,182,184,186,189,191,193,196,198,200,203,205,208,210,213,
+  215,218,220,223,225,228,231,233,236,239,241,244,247,249,252,255,
+};
+
+// Easing curves, mapping progress 0-255 to eased progress 0-255
+const byte EASING_TABLE[3][256] PROGMEM = {
+  // EASE_IN
+  {
+      0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,
+      1,  1,  1,  1,  2,  2,  2,  2,  2,  2,  3,  3,  3,  3,  4,  4,
+      4,  4,  5,  5,  5,  5,  6,  6,  6,  7,  7,  7,  8,  8,  8,  9,
+      9,  9, 10, 10, 11, 11, 11, 12, 12, 13, 13, 14, 14, 15, 15, 16,
+     16, 17, 17, 18, 18, 19, 19, 20, 20, 21, 21, 22, 23, 23, 24, 24,
+     25, 26, 26, 27, 28, 28, 29, 30, 30, 31, 32, 32, 33, 34, 35, 35,
+     36, 37, 38, 38, 39, 40, 41, 42, 42, 43, 44, 45, 46, 47, 47, 48,
+     49, 50, 51, 52, 53, 54, 55, 56, 56, 57, 58, 59, 60, 61, 62, 63,
+     64, 65, 66, 67, 68, 69, 70, 71, 73, 74, 75, 76, 77, 78, 79, 80,
+     81, 82, 84, 85, 86, 87, 88, 89, 91, 92, 93, 94, 95, 97, 98, 99,
+    100,102,103,104,105,107,108,109,111,112,113,115,116,117,119,120,
+    121,123,124,126,127,128,130,131,133,134,136,137,139,140,142,143,
+    145,146,148,149,151,152,154,155,157,158,160,162,163,165,166,168,
+    170,171,173,175,176,178,180,181,183,185,186,188,190,192,193,195,
+    197,199,200,202,204,206,207,209,211,213,215,217,218,220,222,224,
+    226,228,230,232,233,235,237,239,241,243,245,247,249,251,253,255,
+  },
+  // EASE_OUT
+  {
+      0,  2,  4,  6,  8, 10, 12, 14, 16, 18, 20, 22, 23, 25, 27, 29,
+     31, 33, 35, 37, 38, 40, 42, 44, 46, 48, 49, 51, 53, 55, 56, 58,
+     60, 62, 63, 65, 67, 69, 70, 72, 74, 75, 77, 79, 80, 82, 84, 85,
+     87, 89, 90, 92, 93, 95, 97, 98,100,101,103,104,106,107,109,110,
+    112,113,115,116,118,119,121,122,124,125,127,128,129,131,132,134,
+    135,136,138,139,140,142,143,144,146,147,148,150,151,152,153,155,
+    156,157,158,160,161,162,163,164,166,167,168,169,170,171,173,174,
+    175,176,177,178,179,180,181,182,184,185,186,187,188,189,190,191,
+    192,193,194,195,196,197,198,199,199,200,201,202,203,204,205,206,
+    207,208,208,209,210,211,212,213,213,214,215,216,217,217,218,219,
+    220,220,221,222,223,223,224,225,225,226,227,227,228,229,229,230,
+    231,231,232,232,233,234,234,235,235,236,236,237,237,238,238,239,
+    239,240,240,241,241,242,242,243,243,244,244,244,245,245,246,246,
+    246,247,247,247,248,248,248,249,249,249,250,250,250,250,251,251,
+    251,251,252,252,252,252,253,253,253,253,253,253,254,254,254,254,
+    254,254,254,254,255,255,255,255,255,255,255,255,255,255,255,255,
+  },
+  // EASE_IN_OUT
+  {
+      0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,  1,  2,  2,  2,
+      2,  3,  3,  3,  4,  4,  5,  5,  6,  6,  6,  7,  8,  8,  9,  9,
+     10, 10, 11, 12, 12, 13, 14, 14, 15, 16, 17, 17, 18, 19, 20, 21,
+     22, 23, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 37,
+     38, 39, 40, 41, 42, 43, 45, 46, 47, 48, 49, 51, 52, 53, 54, 56,
+     57, 58, 60, 61, 62, 64, 65, 66, 68, 69, 71, 72, 73, 75, 76, 78,
+     79, 81, 82, 84, 85, 87, 88, 90, 91, 93, 94, 96, 97, 99,100,102,
+    103,105,106,108,109,111,113,114,116,117,119,120,122,124,125,127,
+    128,130,131,133,135,136,138,139,141,142,144,146,147,149,150,152,
+    153,155,156,158,159,161,162,164,165,167,168,170,171,173,174,176,
+    177,179,180,182,183,184,186,187,189,190,191,193,194,195,197,198,
+    199,201,202,203,204,206,207,208,209,210,212,213,214,215,216,217,
+    218,220,221,222,223,224,225,226,227,228,229,230,231,232,232,233,
+    234,235,236,237,238,238,239,240,241,241,242,243,243,244,245,245,
+    246,246,247,247,248,249,249,249,250,250,251,251,252,252,252,253,
+    253,253,253,254,254,254,254,254,255,255,255,255,255,255,255,255,
+  },
+};
+
+#endif
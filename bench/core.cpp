@@ -0,0 +1,327 @@
+/**
+ * Host benchmark: the per-message and per-frame costs of the library, in ns/op
+ * and heap allocations/op. See harness.h for the options.
+ *
+ * Each Nightlight has its own broadcast address, so that frames sent by one
+ * case never reach another case's radio.
+ */
+#include <Nightlight.h>
+#include <EEPROM.h>
+#include "harness.h"
+
+const byte BENCH_ADDRESS = 7;
+const byte BENCH_PEER = 9;
+const byte BENCH_SENDERS = 250; // Distinct nodes beaconing at the FriendList
+
+/////////
+
+// loop() with nothing to do, as most calls are on a node
+Nightlight idleNode(0x26B8250100LL);
+FriendList idleFriends;
+OpenNode idleOpen;
+ControlledNode idleControlled;
+
+void benchLoopIdle(unsigned long iterations)
+{
+  unsigned long i;
+  for(i=0; i<iterations; i++) idleNode.loop();
+}
+
+/////////
+
+// A node under control playing a command, with an event bubbling through the whole stack
+Nightlight controlledNode(0x26B8250200LL);
+FriendList controlledFriends;
+OpenNode controlledOpen;
+ControlledNode controlledControlled;
+PulseLight controlledPulse(5);
+byte eventData[EventMessage::LENGTH] = { 1, 128 };
+
+void benchDispatchBubble(unsigned long iterations)
+{
+  unsigned long i;
+  for(i=0; i<iterations; i++) {
+    controlledNode.sendMessage(BENCH_ADDRESS, MSG_EVENT, eventData, EventMessage::LENGTH);
+  }
+}
+
+/////////
+
+// sendMessage() to each kind of address, from a controller with a node listening at BENCH_PEER
+Nightlight sender(0x26B8250300LL);
+Nightlight listener(0x26B8250300LL);
+FriendList senderFriends;
+byte commandData[CommandSendMessage::LENGTH] = { 0x10, 255, 0 };
+byte serialData[] = "0102";
+
+void benchSendSelf(unsigned long iterations)
+{
+  unsigned long i;
+  for(i=0; i<iterations; i++) {
+    sender.sendMessage(BENCH_ADDRESS, MSG_EVENT, eventData, EventMessage::LENGTH);
+  }
+}
+
+// Commands are sent whatever the airtime budget, so every iteration reaches the radio
+void benchSendBroadcast(unsigned long iterations)
+{
+  unsigned long i;
+  for(i=0; i<iterations; i++) {
+    sender.sendMessage(0, MSG_COMMAND_SEND, commandData, CommandSendMessage::LENGTH);
+  }
+}
+
+void benchSendUnicast(unsigned long iterations)
+{
+  unsigned long i;
+  for(i=0; i<iterations; i++) {
+    sender.sendMessage(BENCH_PEER, MSG_COMMAND_SEND, commandData, CommandSendMessage::LENGTH);
+  }
+}
+
+void benchSendSerial(unsigned long iterations)
+{
+  unsigned long i;
+  for(i=0; i<iterations; i++) {
+    sender.sendMessage(-1, MSG_EVENT, serialData, sizeof(serialData) - 1);
+  }
+}
+
+/////////
+
+char hexDigits[] = "0123456789abcdefABCDEF";
+
+void benchHexPair(unsigned long iterations)
+{
+  unsigned long i;
+  for(i=0; i<iterations; i++) {
+    benchSink += hexPair(hexDigits + i % (sizeof(hexDigits) - 2));
+  }
+}
+
+const char *serialScript =
+  "18 0180\n"
+  "10 420000\n"
+  "01\n"
+  "20 controlled\n";
+
+void benchSerialParse(unsigned long iterations)
+{
+  NightlightMessage message;
+  unsigned long i;
+  for(i=0; i<iterations; i++) {
+    if(!stubSerialInput || !*stubSerialInput) stubSerialInput = serialScript;
+    sender.readSerial(&message);
+    benchSink += message.type + message.dataLength;
+  }
+  stubSerialInput = 0;
+}
+
+/////////
+
+// MSG_HELLO from many more nodes than can be tracked, as millis() passes and
+// they expire, so that nodes appear and disappear
+Nightlight crowdNode(0x26B8250400LL);
+FriendList crowdFriends;
+byte helloData[HelloMessage::LENGTH] = { NODE_KIND_OPEN, 1 };
+
+void benchFriendListChurn(unsigned long iterations)
+{
+  unsigned long i;
+  for(i=0; i<iterations; i++) {
+    stubMillis += 2;
+    crowdFriends.receiveMessage(&crowdNode, 1 + (i * 37) % BENCH_SENDERS, MSG_HELLO, helloData, HelloMessage::LENGTH);
+    if(stubMillis % 1000 == 0) crowdFriends.onTimeout(&crowdNode);
+  }
+  benchSink += crowdFriends.numNeighbours();
+}
+
+/////////
+
+char mapKeys[MAP_MAX_ITEMS + 1][12] = { "open", "controlled", "blinky", "pulse", "chase", "missing" };
+Map commands;
+
+void benchMapGet(unsigned long iterations)
+{
+  unsigned long i;
+  for(i=0; i<iterations; i++) {
+    benchSink += (unsigned long)commands.get(mapKeys[i % (MAP_MAX_ITEMS + 1)]);
+  }
+}
+
+/////////
+
+const Keyframe BENCH_KEYFRAMES[] PROGMEM = {
+  { 300, 255, EASE_OUT },
+  { 700, 0, EASE_IN_OUT },
+};
+
+class BenchAnimation : public Animation {
+  protected:
+    void writeChannel(byte pin, byte value) {
+      benchSink += value;
+    }
+};
+
+BenchAnimation animation;
+unsigned long animationFrame = 0;
+
+// One frame of every channel
+void benchAnimationUpdate(unsigned long iterations)
+{
+  unsigned long i;
+  for(i=0; i<iterations; i++) {
+    // Wrap time so that the looping channels never run out
+    animationFrame++;
+    if(animationFrame % 10000 == 0) animation.reset(animationFrame * FRAME_LENGTH);
+    animation.update(animationFrame * FRAME_LENGTH);
+  }
+}
+
+/////////
+
+const byte BENCH_PINS[] = { 3, 5, 6, 9 };
+PatternStore patterns;
+PatternPlayer player;
+unsigned long playerFrame = 0;
+
+static bool storePattern(byte command, const byte *data, unsigned int length)
+{
+  unsigned int offset;
+  uint16_t crc = 0xFFFF;
+  for(offset=0; offset<length; offset++) crc = crc16Update(crc, data[offset]);
+
+  if(!patterns.beginPattern(command, length, crc)) return false;
+  for(offset=0; offset<length; offset+=PATTERN_CHUNK_LENGTH) {
+    byte chunk = length - offset < PATTERN_CHUNK_LENGTH ? length - offset : PATTERN_CHUNK_LENGTH;
+    if(!patterns.writePattern(offset, data + offset, chunk)) return false;
+  }
+  return patterns.endPattern();
+}
+
+// A full index, so that lookups take the most steps
+void benchPatternFind(unsigned long iterations)
+{
+  unsigned long i;
+  for(i=0; i<iterations; i++) benchSink += patterns.find(i & 0xFF);
+}
+
+void benchPatternSelect(unsigned long iterations)
+{
+  unsigned long i;
+  for(i=0; i<iterations; i++) benchSink += patterns.select(i & 0xFF);
+}
+
+// One frame of a four channel pattern, read through the cache
+void benchPatternPlayback(unsigned long iterations)
+{
+  unsigned long i;
+  for(i=0; i<iterations; i++) {
+    playerFrame++;
+    if(playerFrame % 10000 == 0) player.reset(playerFrame * FRAME_LENGTH);
+    player.update(playerFrame * FRAME_LENGTH);
+    benchSink += player.channelOutput(0);
+  }
+}
+
+/////////
+
+void setupNodes()
+{
+  idleNode._myAddressOffset = BENCH_ADDRESS;
+  idleNode.setup();
+  idleOpen.setState_controlled(&idleControlled);
+  idleOpen.setFriendList(&idleFriends);
+  idleNode.pushState(&idleFriends);
+  idleNode.pushState(&idleOpen);
+
+  controlledNode._myAddressOffset = BENCH_ADDRESS;
+  controlledNode.setup();
+  controlledOpen.setState_controlled(&controlledControlled);
+  controlledOpen.setFriendList(&controlledFriends);
+  controlledControlled.setCommand(&controlledPulse);
+  controlledControlled.setFriend(BENCH_PEER);
+  controlledNode.pushState(&controlledFriends);
+  controlledNode.pushState(&controlledOpen);
+  controlledNode.pushState(&controlledControlled);
+  controlledNode.pushState(&controlledPulse);
+
+  sender._myAddressOffset = BENCH_ADDRESS;
+  sender.setup();
+  sender.pushState(&senderFriends);
+  listener._myAddressOffset = BENCH_PEER;
+  listener.setup();
+
+  crowdNode._myAddressOffset = BENCH_ADDRESS;
+  crowdNode.setup();
+  crowdNode.pushState(&crowdFriends);
+
+  byte i;
+  for(i=0; i<MAP_MAX_ITEMS; i++) commands.add(mapKeys[i], &idleOpen);
+
+  for(i=0; i<ANIMATION_MAX_CHANNELS; i++) {
+    animation.addChannel(i, BENCH_KEYFRAMES, 2, 255, i * 50);
+  }
+  animation.reset(0);
+}
+
+void setupPatterns()
+{
+  byte pattern[4 * (5 + 8 * 4) + 1];
+  unsigned int i, j, length = 0;
+
+  // Four channels of eight keyframes
+  pattern[length++] = 4;
+  for(i=0; i<4; i++) {
+    pattern[length++] = i;
+    pattern[length++] = 255;
+    pattern[length++] = i * 50;
+    pattern[length++] = 0;
+    pattern[length++] = 8;
+    for(j=0; j<8; j++) {
+      pattern[length++] = 100 + j * 10;
+      pattern[length++] = 0;
+      pattern[length++] = (j & 1) ? 0 : 255;
+      pattern[length++] = j % 4;
+    }
+  }
+
+  EEPROM.erase();
+  patterns.load();
+  storePattern(0x20, pattern, length);
+  for(i=1; i<PATTERN_MAX_ENTRIES; i++) {
+    storePattern(i * 0x11, pattern, 20);
+  }
+
+  player.setStore(&patterns);
+  player.setPins(BENCH_PINS, 4);
+  player.load(0x20);
+  player.reset(0);
+}
+
+int main(int argc, char **argv)
+{
+  benchInit(argc, argv);
+
+  // Time stands still, so that no timeouts fire, except where a case moves it
+  stubMillis = 1000;
+  setupNodes();
+  setupPatterns();
+
+  benchCase("loop_idle", benchLoopIdle);
+  benchCase("dispatch_bubble", benchDispatchBubble);
+  benchCase("send_self", benchSendSelf);
+  benchCase("send_broadcast", benchSendBroadcast);
+  benchCase("send_unicast", benchSendUnicast);
+  benchCase("send_serial", benchSendSerial);
+  benchCase("hex_pair", benchHexPair);
+  benchCase("serial_parse", benchSerialParse);
+  benchCase("friendlist_churn", benchFriendListChurn);
+  benchCase("map_get", benchMapGet);
+  benchCase("animation_update", benchAnimationUpdate);
+  benchCase("pattern_find", benchPatternFind);
+  benchCase("pattern_select", benchPatternSelect);
+  benchCase("pattern_playback", benchPatternPlayback);
+
+  return benchFinish();
+}
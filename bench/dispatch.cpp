@@ -0,0 +1,111 @@
+/**
+ * Host benchmark: message dispatch through a 3-deep state stack, with virtual
+ * (Nightlight) or compile-time (StaticNightlight, -DSTATIC_DISPATCH) dispatch.
+ *
+ * `make bench` times both variants, and also builds them for size to count the
+ * flash of each variant's own symbols (see DISPATCH_SYMBOLS in the Makefile);
+ * the NightlightLink transport that both link is left out.
+ */
+#include <stdio.h>
+#include <time.h>
+#include <Nightlight.h>
+#include <NightlightStatic.h>
+
+const byte MSG_BENCH = 0x30;
+const byte BENCH_ADDRESS = 7;
+
+unsigned long received;
+
+#ifdef STATIC_DISPATCH
+
+class PassState : public StaticState<PassState> {
+};
+
+class CountState : public StaticState<CountState> {
+  public:
+    template<class M> bool receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength) {
+      received += type;
+      return true;
+    }
+};
+
+class TopState : public StaticState<TopState> {
+  public:
+    template<class M> bool receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength) {
+      return type == MSG_HELLO;
+    }
+};
+
+typedef StaticNightlight<CountState, PassState, TopState> BenchNightlight;
+BenchNightlight nightlight(0x26B8259100LL);
+
+void setupStates()
+{
+  nightlight.link()._myAddressOffset = BENCH_ADDRESS;
+  nightlight.pushState<CountState>();
+  nightlight.pushState<PassState>();
+  nightlight.pushState<TopState>();
+}
+
+const char *variant = "static";
+unsigned long stateBytes = sizeof(PassState) + sizeof(CountState) + sizeof(TopState);
+
+#else
+
+class PassState : public NightlightState {
+};
+
+class CountState : public NightlightState {
+  public:
+    bool receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength) {
+      received += type;
+      return true;
+    }
+};
+
+class TopState : public NightlightState {
+  public:
+    bool receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength) {
+      return type == MSG_HELLO;
+    }
+};
+
+Nightlight nightlight(0x26B8259100LL);
+PassState passState;
+CountState countState;
+TopState topState;
+
+void setupStates()
+{
+  nightlight._myAddressOffset = BENCH_ADDRESS;
+  nightlight.pushState(&countState);
+  nightlight.pushState(&passState);
+  nightlight.pushState(&topState);
+}
+
+const char *variant = "virtual";
+unsigned long stateBytes = sizeof(PassState) + sizeof(CountState) + sizeof(TopState);
+
+#endif
+
+int main()
+{
+  setupStates();
+
+  const unsigned long messages = 50000000;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  unsigned long i;
+  for(i=0; i<messages; i++) {
+    nightlight.sendMessage(BENCH_ADDRESS, MSG_BENCH, 0, 0);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+  printf("dispatch (%s): %.2f ns/message, RAM %lu bytes (machine %lu + states %lu)\n",
+    variant, ns / messages, (unsigned long)sizeof(nightlight) + stateBytes,
+    (unsigned long)sizeof(nightlight), stateBytes);
+  return received == messages * MSG_BENCH ? 0 : 1;
+}
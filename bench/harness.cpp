@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <new>
+#include "harness.h"
+
+volatile unsigned long benchSink;
+
+struct BenchResult {
+  char name[64];
+  double nsPerOp;
+  double allocsPerOp;
+};
+
+static BenchResult _results[BENCH_MAX_CASES];
+static unsigned int _numResults = 0;
+static const char *_jsonPath = 0;
+static const char *_comparePath = 0;
+static double _threshold = BENCH_DEFAULT_THRESHOLD;
+
+// Heap allocations made with new, counted for every case
+static unsigned long _allocations = 0;
+
+void *operator new(size_t size) {
+  _allocations++;
+  void *p = malloc(size ? size : 1);
+  if(!p) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+static double _nowNs()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static void _usage(const char *program)
+{
+  fprintf(stderr, "usage: %s [--json FILE] [--compare FILE] [--threshold PCT]\n", program);
+  exit(2);
+}
+
+void benchInit(int argc, char **argv)
+{
+  int i;
+  for(i=1; i<argc; i++) {
+    if(i + 1 >= argc) _usage(argv[0]);
+
+    if(strcmp(argv[i], "--json") == 0) _jsonPath = argv[++i];
+    else if(strcmp(argv[i], "--compare") == 0) _comparePath = argv[++i];
+    else if(strcmp(argv[i], "--threshold") == 0) _threshold = atof(argv[++i]);
+    else _usage(argv[0]);
+  }
+}
+
+/**
+ * Time a case, doubling its iterations until a repetition is long enough to
+ * measure, then keeping the fastest of several repetitions
+ */
+void benchCase(const char *name, BenchFunction function)
+{
+  unsigned long iterations = 1;
+  unsigned int i;
+  double start, elapsed;
+
+  if(_numResults >= BENCH_MAX_CASES) {
+    fprintf(stderr, "bench: too many cases, skipping %s\n", name);
+    return;
+  }
+
+  for(;;) {
+    start = _nowNs();
+    function(iterations);
+    elapsed = _nowNs() - start;
+    if(elapsed >= BENCH_MIN_REPETITION_MS * 1e6) break;
+    iterations *= 2;
+  }
+
+  double best = elapsed;
+  unsigned long allocations = _allocations;
+  for(i=0; i<BENCH_REPETITIONS; i++) {
+    start = _nowNs();
+    function(iterations);
+    elapsed = _nowNs() - start;
+    if(elapsed < best) best = elapsed;
+  }
+
+  BenchResult *result = &_results[_numResults++];
+  strncpy(result->name, name, sizeof(result->name) - 1);
+  result->name[sizeof(result->name) - 1] = 0;
+  result->nsPerOp = best / iterations;
+  result->allocsPerOp = (double)(_allocations - allocations) / ((double)iterations * BENCH_REPETITIONS);
+
+  printf("%-20s %10.2f ns/op %8.3f allocs/op\n", result->name, result->nsPerOp, result->allocsPerOp);
+  fflush(stdout);
+}
+
+/**
+ * One case per line, so that the baseline can be read back with sscanf and
+ * diffs of it are readable
+ */
+static bool _writeJson(const char *path)
+{
+  unsigned int i;
+  FILE *f = fopen(path, "w");
+  if(!f) {
+    perror(path);
+    return false;
+  }
+
+  fprintf(f, "{\n");
+  for(i=0; i<_numResults; i++) {
+    fprintf(f, "  \"%s\": { \"ns_per_op\": %.2f, \"allocs_per_op\": %.3f }%s\n",
+      _results[i].name, _results[i].nsPerOp, _results[i].allocsPerOp, i + 1 < _numResults ? "," : "");
+  }
+  fprintf(f, "}\n");
+  fclose(f);
+  return true;
+}
+
+/**
+ * Compare the results against a baseline written by --json
+ * Returns the number of regressions, or -1 if the baseline can't be read
+ */
+static int _compare(const char *path)
+{
+  char line[256], name[64];
+  double ns, allocs;
+  unsigned int i;
+  int regressions = 0;
+  bool found[BENCH_MAX_CASES] = { false };
+
+  FILE *f = fopen(path, "r");
+  if(!f) {
+    perror(path);
+    return -1;
+  }
+
+  printf("\nCompared with %s (threshold %.0f%%):\n", path, _threshold);
+  while(fgets(line, sizeof(line), f)) {
+    if(sscanf(line, " \"%63[^\"]\": { \"ns_per_op\": %lf, \"allocs_per_op\": %lf", name, &ns, &allocs) != 3) continue;
+
+    for(i=0; i<_numResults; i++) {
+      if(strcmp(_results[i].name, name) == 0) break;
+    }
+    if(i == _numResults) {
+      printf("%-20s missing from this run\n", name);
+      continue;
+    }
+    found[i] = true;
+
+    BenchResult *result = &_results[i];
+    bool slower = result->nsPerOp > ns * (1 + _threshold / 100) + BENCH_SLACK_NS;
+    bool allocating = result->allocsPerOp > allocs + 0.0005;
+    printf("%-20s %10.2f -> %10.2f ns/op %+7.1f%%%s%s\n", name, ns, result->nsPerOp,
+      ns > 0 ? (result->nsPerOp / ns - 1) * 100 : 0,
+      slower ? "  REGRESSION" : "", allocating ? "  MORE ALLOCATIONS" : "");
+    if(slower || allocating) regressions++;
+  }
+  fclose(f);
+
+  for(i=0; i<_numResults; i++) {
+    if(!found[i]) printf("%-20s not in the baseline\n", _results[i].name);
+  }
+  return regressions;
+}
+
+/**
+ * Write and compare the results, as asked for on the command line
+ * Returns the process exit status: 0, or 1 if there were regressions
+ */
+int benchFinish()
+{
+  int status = 0;
+
+  if(_jsonPath && !_writeJson(_jsonPath)) status = 1;
+
+  if(_comparePath) {
+    int regressions = _compare(_comparePath);
+    if(regressions < 0) {
+      status = 1;
+    } else if(regressions > 0) {
+      printf("%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+      status = 1;
+    }
+  }
+  return status;
+}
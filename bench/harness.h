@@ -0,0 +1,32 @@
+/**
+ * Host benchmark harness: times named cases in ns/op, counts heap allocations
+ * per op, and writes or compares against a JSON baseline.
+ *
+ *   benchInit(argc, argv);
+ *   benchCase("map_get", benchMapGet);
+ *   return benchFinish();
+ *
+ * Options: --json FILE writes the results, --compare FILE fails if a case is
+ * slower than the baseline by more than --threshold PCT (default 25), or
+ * allocates more.
+ */
+#ifndef BenchHarness_h
+#define BenchHarness_h
+
+// A case runs its operation this many times
+typedef void (*BenchFunction)(unsigned long iterations);
+
+const unsigned int BENCH_MAX_CASES = 32;
+const double BENCH_MIN_REPETITION_MS = 20; // Iterations are doubled until one repetition takes this long
+const unsigned int BENCH_REPETITIONS = 7;  // The fastest repetition is reported
+const double BENCH_DEFAULT_THRESHOLD = 25; // Percent slower than the baseline that counts as a regression
+const double BENCH_SLACK_NS = 1;           // Absolute slack, so that very fast cases don't fail on timer noise
+
+// Cases add their results to this, so that the compiler can't optimise them away
+extern volatile unsigned long benchSink;
+
+void benchInit(int argc, char **argv);
+void benchCase(const char *name, BenchFunction function);
+int benchFinish();
+
+#endif
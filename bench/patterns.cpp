@@ -0,0 +1,96 @@
+/**
+ * Host benchmark: pattern store write throughput and wear, and playback cache hits.
+ * Lookup and playback times are measured by bench/core.cpp.
+ */
+#include <stdio.h>
+#include <time.h>
+#include <Nightlight.h>
+#include <EEPROM.h>
+
+const byte BENCH_PINS[] = { 3, 5, 6, 9 };
+
+static double elapsedMs(struct timespec *start)
+{
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static bool storePattern(PatternStore *store, byte command, const byte *data, unsigned int length)
+{
+  unsigned int offset;
+  uint16_t crc = 0xFFFF;
+  for(offset=0; offset<length; offset++) crc = crc16Update(crc, data[offset]);
+
+  if(!store->beginPattern(command, length, crc)) return false;
+  for(offset=0; offset<length; offset+=PATTERN_CHUNK_LENGTH) {
+    byte chunk = length - offset < PATTERN_CHUNK_LENGTH ? length - offset : PATTERN_CHUNK_LENGTH;
+    if(!store->writePattern(offset, data + offset, chunk)) return false;
+  }
+  return store->endPattern();
+}
+
+int main()
+{
+  PatternStore store;
+  struct timespec start;
+  byte pattern[4 * (5 + 8 * 4) + 1];
+  unsigned int i, j, length = 0;
+  unsigned long checksum = 0;
+
+  // Four channels of eight keyframes
+  pattern[length++] = 4;
+  for(i=0; i<4; i++) {
+    pattern[length++] = i;
+    pattern[length++] = 255;
+    pattern[length++] = i * 50;
+    pattern[length++] = 0;
+    pattern[length++] = 8;
+    for(j=0; j<8; j++) {
+      pattern[length++] = 100 + j * 10;
+      pattern[length++] = 0;
+      pattern[length++] = (j & 1) ? 0 : 255;
+      pattern[length++] = j % 4;
+    }
+  }
+
+  // Write throughput: rewrite one command, as when a show is updated repeatedly
+  EEPROM.erase();
+  store.load();
+  const unsigned int rewrites = 1000;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(i=0; i<rewrites; i++) {
+    pattern[length - 2] = i;
+    storePattern(&store, 0x10, pattern, length);
+  }
+  double ms = elapsedMs(&start);
+  unsigned long maxWear = 0;
+  for(i=0; i<EEPROM_STUB_SIZE; i++) {
+    if(EEPROM.wear[i] > maxWear) maxWear = EEPROM.wear[i];
+  }
+  printf("pattern writes: %u x %u bytes, %.0f ns/byte on the host, %.0f bytes/s at %u usec per changed EEPROM cell, max wear %lu writes/cell\n",
+    rewrites, length, ms * 1e6 / (rewrites * length),
+    (double)rewrites * length * 1e6 / EEPROM.writeMicros, EEPROM_STUB_WRITE_MICROS, maxWear);
+
+  // Playback through the read cache
+  EEPROM.erase();
+  store.load();
+  storePattern(&store, 0x20, pattern, length);
+  PatternPlayer player;
+  player.setStore(&store);
+  player.setPins(BENCH_PINS, 4);
+  player.load(0x20);
+  player.reset(0);
+
+  const unsigned long frames = 1000000;
+  unsigned long misses = store.cacheMisses();
+  unsigned long reads = EEPROM.reads;
+  for(i=1; i<=frames; i++) {
+    if(i % 10000 == 0) player.reset(i * FRAME_LENGTH);
+    player.update(i * FRAME_LENGTH);
+    checksum += player.channelOutput(0);
+  }
+  printf("pattern playback: %.2f cache misses and %.1f EEPROM reads per 1000 frames of 4 channels (checksum %lu)\n",
+    (store.cacheMisses() - misses) * 1000.0 / frames, (EEPROM.reads - reads) * 1000.0 / frames, checksum);
+  return 0;
+}
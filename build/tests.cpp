@@ -0,0 +1,67 @@
+#include <cstdio>
+#include <cxxtest/TestSuite.h>
+#include "./tests/animation.h"
+#include "./tests/beacon.h"
+#include "./tests/channels.h"
+#include "./tests/controller.h"
+#include "./tests/links.h"
+#include "./tests/messages.h"
+#include "./tests/mytest.h"
+#include "./tests/patterns.h"
+#include "./tests/priority.h"
+#include "./tests/static.h"
+int CxxTest::failures=0;
+int main(){
+{ AnimationTestSuite s; s.setUp(); printf("AnimationTestSuite::testTableEndpoints\n"); s.testTableEndpoints(); s.tearDown(); }
+{ AnimationTestSuite s; s.setUp(); printf("AnimationTestSuite::testLinearInterpolation\n"); s.testLinearInterpolation(); s.tearDown(); }
+{ AnimationTestSuite s; s.setUp(); printf("AnimationTestSuite::testLevelScalesOutput\n"); s.testLevelScalesOutput(); s.tearDown(); }
+{ AnimationTestSuite s; s.setUp(); printf("AnimationTestSuite::testModWheelSpeedsUp\n"); s.testModWheelSpeedsUp(); s.tearDown(); }
+{ AnimationTestSuite s; s.setUp(); printf("AnimationTestSuite::testLoopsAndDelay\n"); s.testLoopsAndDelay(); s.tearDown(); }
+{ AnimationTestSuite s; s.setUp(); printf("AnimationTestSuite::testOutputOnlyWrittenOnChange\n"); s.testOutputOnlyWrittenOnChange(); s.tearDown(); }
+{ AnimationTestSuite s; s.setUp(); printf("AnimationTestSuite::testChannelLimit\n"); s.testChannelLimit(); s.tearDown(); }
+{ AnimationTestSuite s; s.setUp(); printf("AnimationTestSuite::testRepeatedCommandsReplaceTheRunningOne\n"); s.testRepeatedCommandsReplaceTheRunningOne(); s.tearDown(); }
+{ AnimationTestSuite s; s.setUp(); printf("AnimationTestSuite::testLeavingStopsTheCommand\n"); s.testLeavingStopsTheCommand(); s.tearDown(); }
+{ BeaconTestSuite s; s.setUp(); printf("BeaconTestSuite::testIntervalGrowsWithNeighbours\n"); s.testIntervalGrowsWithNeighbours(); s.tearDown(); }
+{ BeaconTestSuite s; s.setUp(); printf("BeaconTestSuite::testExpiryFollowsAdvertisedInterval\n"); s.testExpiryFollowsAdvertisedInterval(); s.tearDown(); }
+{ BeaconTestSuite s; s.setUp(); printf("BeaconTestSuite::testConstantAirtimeAsSwarmGrows\n"); s.testConstantAirtimeAsSwarmGrows(); s.tearDown(); }
+{ BeaconTestSuite s; s.setUp(); printf("BeaconTestSuite::testControllerKeepsNodesInALargeSwarm\n"); s.testControllerKeepsNodesInALargeSwarm(); s.tearDown(); }
+{ ChannelsTestSuite s; s.setUp(); printf("ChannelsTestSuite::testNodesFollowControllerToWorkingChannel\n"); s.testNodesFollowControllerToWorkingChannel(); s.tearDown(); }
+{ ChannelsTestSuite s; s.setUp(); printf("ChannelsTestSuite::testNodesReturnWhenControllerIsLost\n"); s.testNodesReturnWhenControllerIsLost(); s.tearDown(); }
+{ ChannelsTestSuite s; s.setUp(); printf("ChannelsTestSuite::testThroughputScalesWithChannels\n"); s.testThroughputScalesWithChannels(); s.tearDown(); }
+{ ControllerTestSuite s; s.setUp(); printf("ControllerTestSuite::testNodeSet\n"); s.testNodeSet(); s.tearDown(); }
+{ ControllerTestSuite s; s.setUp(); printf("ControllerTestSuite::testControlsManyNodesWithBoundedAirtime\n"); s.testControlsManyNodesWithBoundedAirtime(); s.tearDown(); }
+{ ControllerTestSuite s; s.setUp(); printf("ControllerTestSuite::testNodesRejoinAfterRelease\n"); s.testNodesRejoinAfterRelease(); s.tearDown(); }
+{ LinksTestSuite s; s.setUp(); printf("LinksTestSuite::testStatistics\n"); s.testStatistics(); s.tearDown(); }
+{ LinksTestSuite s; s.setUp(); printf("LinksTestSuite::testLeastRecentlyUsedPeerForgotten\n"); s.testLeastRecentlyUsedPeerForgotten(); s.tearDown(); }
+{ LinksTestSuite s; s.setUp(); printf("LinksTestSuite::testAdaptationReducesBlockedTime\n"); s.testAdaptationReducesBlockedTime(); s.tearDown(); }
+{ MessagesTestSuite s; s.setUp(); printf("MessagesTestSuite::testViews\n"); s.testViews(); s.tearDown(); }
+{ MessagesTestSuite s; s.setUp(); printf("MessagesTestSuite::testOptionalFieldsFilledIn\n"); s.testOptionalFieldsFilledIn(); s.tearDown(); }
+{ MessagesTestSuite s; s.setUp(); printf("MessagesTestSuite::testRoundTrip\n"); s.testRoundTrip(); s.tearDown(); }
+{ MessagesTestSuite s; s.setUp(); printf("MessagesTestSuite::testMalformedFramesRejected\n"); s.testMalformedFramesRejected(); s.tearDown(); }
+{ MyTestSuite s; s.setUp(); printf("MyTestSuite::testAddition\n"); s.testAddition(); s.tearDown(); }
+{ MyTestSuite s; s.setUp(); printf("MyTestSuite::testNextTimeout\n"); s.testNextTimeout(); s.tearDown(); }
+{ PatternsTestSuite s; s.setUp(); printf("PatternsTestSuite::testStoreAndReload\n"); s.testStoreAndReload(); s.tearDown(); }
+{ PatternsTestSuite s; s.setUp(); printf("PatternsTestSuite::testBankSelection\n"); s.testBankSelection(); s.tearDown(); }
+{ PatternsTestSuite s; s.setUp(); printf("PatternsTestSuite::testFailedTransferKeepsOldPattern\n"); s.testFailedTransferKeepsOldPattern(); s.tearDown(); }
+{ PatternsTestSuite s; s.setUp(); printf("PatternsTestSuite::testFull\n"); s.testFull(); s.tearDown(); }
+{ PatternsTestSuite s; s.setUp(); printf("PatternsTestSuite::testWritesAreSpreadOut\n"); s.testWritesAreSpreadOut(); s.tearDown(); }
+{ PatternsTestSuite s; s.setUp(); printf("PatternsTestSuite::testPlaysLikeProgmemAnimation\n"); s.testPlaysLikeProgmemAnimation(); s.tearDown(); }
+{ PatternsTestSuite s; s.setUp(); printf("PatternsTestSuite::testReplacingAPlayingPattern\n"); s.testReplacingAPlayingPattern(); s.tearDown(); }
+{ PatternsTestSuite s; s.setUp(); printf("PatternsTestSuite::testControlledNodePlaysStoredPattern\n"); s.testControlledNodePlaysStoredPattern(); s.tearDown(); }
+{ PatternsTestSuite s; s.setUp(); printf("PatternsTestSuite::testRepeatedPatternCommandsReplaceTheRunningOne\n"); s.testRepeatedPatternCommandsReplaceTheRunningOne(); s.tearDown(); }
+{ PatternsTestSuite s; s.setUp(); printf("PatternsTestSuite::testOverTheAir\n"); s.testOverTheAir(); s.tearDown(); }
+{ PatternsTestSuite s; s.setUp(); printf("PatternsTestSuite::testOverTheAirWithBackgroundTelemetry\n"); s.testOverTheAirWithBackgroundTelemetry(); s.tearDown(); }
+{ PriorityTestSuite s; s.setUp(); printf("PriorityTestSuite::testMessagePriority\n"); s.testMessagePriority(); s.tearDown(); }
+{ PriorityTestSuite s; s.setUp(); printf("PriorityTestSuite::testPresenceDroppedOverBudget\n"); s.testPresenceDroppedOverBudget(); s.tearDown(); }
+{ PriorityTestSuite s; s.setUp(); printf("PriorityTestSuite::testCommandsPreemptBeacons\n"); s.testCommandsPreemptBeacons(); s.tearDown(); }
+{ PriorityTestSuite s; s.setUp(); printf("PriorityTestSuite::testControlDeferredUntilBudget\n"); s.testControlDeferredUntilBudget(); s.tearDown(); }
+{ PriorityTestSuite s; s.setUp(); printf("PriorityTestSuite::testQueueFullDropsLowestPriority\n"); s.testQueueFullDropsLowestPriority(); s.tearDown(); }
+{ PriorityTestSuite s; s.setUp(); printf("PriorityTestSuite::testClassesDontBlockEachOther\n"); s.testClassesDontBlockEachOther(); s.tearDown(); }
+{ StaticTestSuite s; s.setUp(); printf("StaticTestSuite::testBubblesFromTopOfStack\n"); s.testBubblesFromTopOfStack(); s.tearDown(); }
+{ StaticTestSuite s; s.setUp(); printf("StaticTestSuite::testRemoveAndChangeState\n"); s.testRemoveAndChangeState(); s.tearDown(); }
+{ StaticTestSuite s; s.setUp(); printf("StaticTestSuite::testTimeoutAndFinish\n"); s.testTimeoutAndFinish(); s.tearDown(); }
+{ StaticTestSuite s; s.setUp(); printf("StaticTestSuite::testNoVirtualOverhead\n"); s.testNoVirtualOverhead(); s.tearDown(); }
+{ StaticTestSuite s; s.setUp(); printf("StaticTestSuite::testNoDynamicStack\n"); s.testNoDynamicStack(); s.tearDown(); }
+{ StaticTestSuite s; s.setUp(); printf("StaticTestSuite::testStockStatesMatchNightlight\n"); s.testStockStatesMatchNightlight(); s.tearDown(); }
+{ StaticTestSuite s; s.setUp(); printf("StaticTestSuite::testFullStack\n"); s.testFullStack(); s.tearDown(); }
+printf(CxxTest::failures?"FAILED %d\n":"OK\n", CxxTest::failures); return CxxTest::failures?1:0; }
@@ -10,6 +10,7 @@
 #include <SPI.h>
 #include "nRF24L01.h"
 #include "RF24.h"
+#include <EEPROM.h>
 #include <Nightlight.h>
 
 #include <serial>
@@ -32,12 +33,19 @@ BlinkyLight blinky;
 
 FriendList friendList;
 
+// Patterns sent over the radio, kept in EEPROM and played on PWM pins
+PatternStore patternStore;
+PatternPlayer patternPlayer;
+PatternReceiver patternReceiver;
+const byte patternPins[] = { 3, 5, 6 };
+
 void setup(void)
 {
    Serial.begin(57600, SERIAL_8N1);
   
   // Wire together the states (dependency injection in Arduino, oh my)
   openNode.setState_controlled(&controlledNode);
+  openNode.setFriendList(&friendList);
   controlledNode.setState_lostControl(&openNode);
 
   // Swapping between states triggered from commands on the serial input
@@ -49,11 +57,19 @@ void setup(void)
   // Connect the LED to the output 
   controlledNode.setCommand(&blinky);
 
+  // Stored patterns take precedence over blinky
+  patternStore.load();
+  patternPlayer.setStore(&patternStore);
+  patternPlayer.setPins(patternPins, 3);
+  patternReceiver.setStore(&patternStore);
+  controlledNode.setPatterns(&patternPlayer);
+
   nightlight.setup();
 
   nightlight.enableSerial();
 
   // Starting state
+  nightlight.pushState(&patternReceiver);
   nightlight.pushState(&friendList);
   nightlight.pushState(&openNode);
 }
@@ -0,0 +1,24 @@
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include <stdint.h>
+
+const unsigned int EEPROM_HOST_SIZE = 1024;
+
+// EEPROM for the Linux host port
+// Held in RAM, starting erased, so stored patterns don't outlive the process.
+class EEPROMClass {
+  public:
+    EEPROMClass();
+    uint8_t read(int address);
+    void write(int address, uint8_t value);
+    void update(int address, uint8_t value);
+    uint16_t length();
+
+  private:
+    uint8_t _cells[EEPROM_HOST_SIZE];
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
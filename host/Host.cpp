@@ -0,0 +1,406 @@
+#include <RF24.h>
+#include <EEPROM.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "NightlightHost.h"
+
+int hostRadioFd = -1;
+int hostSerialIn = STDIN_FILENO;
+int hostSerialOut = STDOUT_FILENO;
+
+SerialClass Serial;
+EEPROMClass EEPROM;
+
+static RF24 *_radio = 0;     // The radio of the Nightlight being run, set by begin()
+static bool _radioClosed = false;
+static bool _serialClosed = false;
+static bool _serialOpened = false;
+
+/**
+ * Write all of a buffer to a non-blocking descriptor
+ */
+static void _writeAll(int fd, const void *data, int length)
+{
+  const byte *p = (const byte *)data;
+  struct pollfd out = { fd, POLLOUT, 0 };
+
+  while(length > 0 && fd >= 0) {
+    int n = ::write(fd, p, length);
+    if(n > 0) {
+      p += n;
+      length -= n;
+    } else if(n < 0 && (errno == EAGAIN || errno == EINTR)) {
+      poll(&out, 1, 100);
+    } else {
+      return;
+    }
+  }
+}
+
+/**
+ * Raw, non-blocking access to a tty; other files are just made non-blocking
+ */
+static int _open(const char *path, speed_t speed)
+{
+  int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if(fd < 0) return -1;
+
+  if(isatty(fd)) {
+    struct termios tio;
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    cfsetspeed(&tio, speed);
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  return fd;
+}
+
+bool hostOpenRadio(const char *path)
+{
+  hostRadioFd = _open(path, B115200);
+  return hostRadioFd >= 0;
+}
+
+bool hostOpenSerial(const char *path)
+{
+  int fd = _open(path, B57600);
+  if(fd < 0) return false;
+
+  hostSerialIn = fd;
+  hostSerialOut = fd;
+  _serialOpened = true;
+  return true;
+}
+
+/**
+ * Whether loop() has any input to read
+ */
+static bool _pending()
+{
+  if(_radio && _radio->available()) return true;
+  return Serial.available();
+}
+
+static void _watch(int epoll, int fd)
+{
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+}
+
+void hostRun(Nightlight *nightlight)
+{
+  int epoll = epoll_create1(EPOLL_CLOEXEC);
+  int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  struct epoll_event events[4];
+  struct itimerspec next;
+  unsigned long wait;
+  uint64_t expirations;
+
+  int flags = fcntl(hostSerialIn, F_GETFL);
+  if(flags >= 0) fcntl(hostSerialIn, F_SETFL, flags | O_NONBLOCK);
+
+  if(hostRadioFd >= 0) _watch(epoll, hostRadioFd);
+  if(hostSerialIn >= 0) _watch(epoll, hostSerialIn);
+  _watch(epoll, timer);
+
+  while(!_radioClosed) {
+    // loop() reads one radio and one serial message per call, so run it until both are drained
+    do {
+      nightlight->loop();
+    } while(_pending());
+
+    if(_serialClosed && hostSerialIn >= 0) {
+      epoll_ctl(epoll, EPOLL_CTL_DEL, hostSerialIn, 0);
+      hostSerialIn = -1;
+    }
+
+    wait = nightlight->nextTimeout();
+    if(wait == 0) continue;
+
+    // A zero it_value disarms the timer
+    memset(&next, 0, sizeof(next));
+    if(wait != NO_TIMEOUT) {
+      next.it_value.tv_sec = wait / 1000;
+      next.it_value.tv_nsec = (wait % 1000) * 1000000L;
+    }
+    timerfd_settime(timer, 0, &next, 0);
+
+    if(epoll_wait(epoll, events, 4, -1) < 0 && errno != EINTR) break;
+    if(read(timer, &expirations, sizeof(expirations)) < 0) expirations = 0;
+  }
+
+  if(flags >= 0 && hostSerialIn >= 0) fcntl(hostSerialIn, F_SETFL, flags);
+  close(timer);
+  close(epoll);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+RF24::RF24(int, int) {
+  _pipesOpen = 0;
+  _writingPipe = 0;
+  _channel = 0;
+  _bufferLength = 0;
+  _frameLength = 0;
+}
+
+void RF24::begin() { _radio = this; }
+
+void RF24::setRetries(int, int) {}
+void RF24::setPayloadSize(int) {}
+void RF24::enableDynamicPayloads() {}
+void RF24::setAutoAck (bool) {}
+void RF24::setAutoAck (uint8_t, bool) {}
+void RF24::setDataRate(int) {}
+void RF24::setPALevel(int) {}
+
+// The stream carries frames both ways at once, so there is no mode to switch
+void RF24::startListening() {}
+void RF24::stopListening() {}
+
+void RF24::openReadingPipe(uint8_t pipe, uint64_t address) {
+  _readingPipes[pipe] = address & 0xFFFFFFFFFFULL;
+  _pipesOpen |= 1 << pipe;
+}
+
+void RF24::openWritingPipe(uint64_t address) {
+  _writingPipe = address & 0xFFFFFFFFFFULL;
+}
+
+void RF24::setChannel(uint8_t channel) { _channel = channel; }
+uint8_t RF24::getChannel() { return _channel; }
+
+bool RF24::testCarrier() { return false; }
+
+uint8_t RF24::read_register(uint8_t) { return 0; }
+
+bool RF24::available() {
+  return _nextFrame();
+}
+
+uint8_t RF24::getDynamicPayloadSize() {
+  return _frameLength;
+}
+
+bool RF24::write(byte *packet, int length) {
+  byte frame[RF24_HOST_HEADER + 32];
+  int i;
+
+  if(length < 1 || length > 32) return false;
+
+  frame[0] = RF24_HOST_SYNC;
+  frame[1] = length;
+  frame[2] = _channel;
+  for(i=0; i<5; i++) {
+    frame[3+i] = _writingPipe >> (8*i);
+  }
+  memcpy(frame + RF24_HOST_HEADER, packet, length);
+
+  _writeAll(hostRadioFd, frame, RF24_HOST_HEADER + length);
+  return true;
+}
+
+bool RF24::startWrite(byte *packet, int length) {
+  return write(packet, length);
+}
+
+bool RF24::read(byte *packet, int length) {
+  if(!_nextFrame()) return false;
+
+  int frameSize = RF24_HOST_HEADER + _frameLength;
+  memcpy(packet, _buffer + RF24_HOST_HEADER, length < _frameLength ? length : _frameLength);
+
+  _bufferLength -= frameSize;
+  memmove(_buffer, _buffer + frameSize, _bufferLength);
+  _frameLength = 0;
+  return true;
+}
+
+/**
+ * Find the next frame for this radio at the start of the buffer, reading more of the stream as needed
+ */
+bool RF24::_nextFrame() {
+  int i, skip, n;
+  uint64_t pipe;
+
+  while(!_frameLength) {
+    // Resynchronise on the next sync byte
+    for(skip=0; skip<_bufferLength && _buffer[skip] != RF24_HOST_SYNC; skip++);
+
+    if(skip == 0 && _bufferLength >= RF24_HOST_HEADER) {
+      byte length = _buffer[1];
+      if(length < 1 || length > 32) {
+        skip = 1;
+
+      } else if(_bufferLength >= RF24_HOST_HEADER + length) {
+        pipe = 0;
+        for(i=0; i<5; i++) {
+          pipe |= (uint64_t)_buffer[3+i] << (8*i);
+        }
+        for(i=0; i<6; i++) {
+          if((_pipesOpen & (1 << i)) && _readingPipes[i] == pipe) break;
+        }
+
+        if(_buffer[2] == _channel && i < 6) {
+          _frameLength = length;
+          break;
+        }
+        skip = RF24_HOST_HEADER + length;
+      }
+    }
+
+    if(skip) {
+      _bufferLength -= skip;
+      memmove(_buffer, _buffer + skip, _bufferLength);
+      continue;
+    }
+
+    // Need more of the stream
+    if(hostRadioFd < 0) return false;
+    n = ::read(hostRadioFd, _buffer + _bufferLength, RF24_HOST_BUFFER - _bufferLength);
+    if(n <= 0) {
+      if(n == 0 || (errno != EAGAIN && errno != EINTR)) _radioClosed = true;
+      return false;
+    }
+    _bufferLength += n;
+  }
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+void SerialClass::begin(long baud, int) {
+  _bufferLength = 0;
+  if(!_serialOpened || !isatty(hostSerialIn)) return;
+
+  speed_t speed = B57600;
+  switch(baud) {
+    case 9600: speed = B9600; break;
+    case 19200: speed = B19200; break;
+    case 38400: speed = B38400; break;
+    case 115200: speed = B115200; break;
+  }
+
+  struct termios tio;
+  tcgetattr(hostSerialIn, &tio);
+  cfsetspeed(&tio, speed);
+  tcsetattr(hostSerialIn, TCSANOW, &tio);
+}
+
+bool SerialClass::available() {
+  int n;
+
+  if(hostSerialIn < 0) return false;
+  if(_bufferLength == SERIAL_HOST_BUFFER || memchr(_buffer, '\n', _bufferLength)) return true;
+
+  n = ::read(hostSerialIn, _buffer + _bufferLength, SERIAL_HOST_BUFFER - _bufferLength);
+  if(n <= 0) {
+    if(n == 0 || (errno != EAGAIN && errno != EINTR)) _serialClosed = true;
+    return false;
+  }
+  _bufferLength += n;
+
+  return _bufferLength == SERIAL_HOST_BUFFER || memchr(_buffer, '\n', _bufferLength);
+}
+
+int SerialClass::readBytesUntil(char terminator, char *buffer, int length) {
+  int n, consumed;
+
+  for(n=0; n<length && n<_bufferLength && _buffer[n] != terminator; n++);
+  memcpy(buffer, _buffer, n);
+
+  // Drop the terminator too
+  consumed = (n < _bufferLength && _buffer[n] == terminator) ? n + 1 : n;
+  _bufferLength -= consumed;
+  memmove(_buffer, _buffer + consumed, _bufferLength);
+  return n;
+}
+
+void SerialClass::write(const char *s) { _writeAll(hostSerialOut, s, strlen(s)); }
+void SerialClass::write(byte b) { _writeAll(hostSerialOut, &b, 1); }
+void SerialClass::print(const char *s) { write(s); }
+void SerialClass::print(char c) { write((byte)c); }
+
+void SerialClass::print(int i) {
+  char s[12];
+  snprintf(s, sizeof(s), "%d", i);
+  write(s);
+}
+
+void SerialClass::print(unsigned long i) {
+  char s[24];
+  snprintf(s, sizeof(s), "%lu", i);
+  write(s);
+}
+
+void SerialClass::print(int i, int base) {
+  char s[12];
+  snprintf(s, sizeof(s), base == HEX ? "%X" : "%d", i);
+  write(s);
+}
+
+void SerialClass::println(const char *s) {
+  write(s);
+  write("\n");
+}
+
+void SerialClass::println(int i) {
+  print(i);
+  write("\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+EEPROMClass::EEPROMClass() {
+  memset(_cells, 0xFF, sizeof(_cells));
+}
+
+uint8_t EEPROMClass::read(int address) { return _cells[address % EEPROM_HOST_SIZE]; }
+void EEPROMClass::write(int address, uint8_t value) { _cells[address % EEPROM_HOST_SIZE] = value; }
+void EEPROMClass::update(int address, uint8_t value) { write(address, value); }
+uint16_t EEPROMClass::length() { return EEPROM_HOST_SIZE; }
+
+////////////////////////////////////////////////////////////////////////////////////
+
+void pinMode(int, int) {}
+void digitalWrite(int, bool) {}
+void analogWrite(int, int) {}
+
+int analogRead(int) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_nsec ^ getpid()) & 1023;
+}
+
+void delay(int ms) {
+  struct timespec t = { ms / 1000, (ms % 1000) * 1000000L };
+  while(nanosleep(&t, &t) < 0 && errno == EINTR);
+}
+
+void randomSeed(int seed) {
+  srandom(seed);
+}
+
+int random(int max) {
+  return max > 0 ? ::random() % max : 0;
+}
+
+unsigned long millis() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
@@ -0,0 +1,37 @@
+#ifndef NightlightHost_h
+#define NightlightHost_h
+
+#include "Nightlight.h"
+
+/**
+ * Running Nightlight as a Linux process.
+ *
+ *   Nightlight nightlight(0x26B8259100LL);
+ *
+ *   int main() {
+ *     hostOpenRadio("/dev/pts/3");
+ *     nightlight.setup();
+ *     nightlight.pushState(&controllerState);
+ *     hostRun(&nightlight);
+ *   }
+ *
+ * Build with -I ./host so that Nightlight picks up host/RF24.h instead of the
+ * Arduino libraries. The radio is a simulated one, a framed byte stream over a
+ * PTY, FIFO or socket (see host/RF24.h), and serial is stdin and stdout unless
+ * hostOpenSerial() is given a tty.
+ */
+
+extern int hostRadioFd;   // Radio stream, -1 until hostOpenRadio()
+extern int hostSerialIn;  // Serial input, stdin by default
+extern int hostSerialOut; // Serial output, stdout by default
+
+bool hostOpenRadio(const char *path);
+bool hostOpenSerial(const char *path);
+
+/**
+ * Call nightlight->loop() whenever there is input or a timeout is due, and
+ * sleep in epoll_wait() otherwise. Returns when the radio stream closes.
+ */
+void hostRun(Nightlight *nightlight);
+
+#endif
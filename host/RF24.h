@@ -0,0 +1,115 @@
+// Arduino types
+#include <stdint.h>
+typedef unsigned char byte;
+
+#ifndef RF24_h
+#define RF24_h
+
+const byte RF24_HOST_SYNC = 0xA5;      // First byte of every frame on the radio stream
+const byte RF24_HOST_HEADER = 8;       // Sync, payload length, channel, 5 byte pipe address
+const int RF24_HOST_BUFFER = 256;      // Bytes of radio stream buffered while looking for a whole frame
+const int SERIAL_HOST_BUFFER = 80;     // Longest serial line, as read by Nightlight::readSerial()
+
+// Linux host port of RF24, for running and testing Nightlight as a process
+// The radio is simulated by a byte stream, e.g. a PTY or socket to a test
+// harness playing the other nodes, carrying one frame per payload:
+//
+//   0xA5, payload length (1-32), channel, pipe address (5 bytes, LSB first), payload
+//
+// Frames written are sent on that channel and pipe. Frames read are those
+// sent by the other end; they are kept if they are on this radio's channel and
+// match one of its reading pipes. There are no acknowledgements, so every
+// write succeeds, and Nightlight's link statistics never see a loss. Nothing
+// blocks; hostRun() in NightlightHost.h sleeps until the stream has data.
+class RF24 {
+  public:
+    RF24(int, int);
+    void begin();
+    bool available();
+    void setRetries(int, int);
+    void setPayloadSize(int);
+    void openReadingPipe(uint8_t, uint64_t);
+    void openWritingPipe(uint64_t);
+    void startListening();
+    void stopListening();
+    void enableDynamicPayloads();
+    void setAutoAck (bool enable);
+    void setAutoAck (uint8_t pipe, bool enable);
+    void setDataRate(int);
+    void setPALevel(int);
+    void setChannel(uint8_t);
+    uint8_t getChannel();
+    bool testCarrier();
+
+    uint8_t getDynamicPayloadSize();
+    bool write(byte *, int);
+    bool startWrite(byte *, int);
+    bool read(byte *, int);
+
+  protected:
+    uint8_t read_register(uint8_t reg);
+
+  private:
+    uint64_t _readingPipes[6];
+    byte _pipesOpen; // Bit per reading pipe
+    uint64_t _writingPipe;
+    uint8_t _channel;
+
+    byte _buffer[RF24_HOST_BUFFER];
+    int _bufferLength;
+    byte _frameLength; // Length of the payload at _buffer + RF24_HOST_HEADER, 0 if none yet
+
+    bool _nextFrame();
+};
+
+
+// Serial over a tty, or stdin and stdout
+// available() is true once a whole line has arrived, so that
+// readBytesUntil() never has to wait for the rest of it.
+class SerialClass {
+  public:
+    void begin(long, int);
+    bool available();
+    int readBytesUntil(char, char *, int);
+    void write(const char *);
+    void write(byte);
+    void println(const char *);
+    void println(int);
+    void print(const char *);
+    void print(char);
+    void print(int);
+    void print(unsigned long);
+    void print(int, int);
+
+  private:
+    char _buffer[SERIAL_HOST_BUFFER];
+    int _bufferLength;
+};
+
+extern SerialClass Serial;
+
+// Pins are ignored on the host; analogRead() returns noise like a floating pin
+void pinMode(int, int);
+void digitalWrite(int, bool);
+void analogWrite(int, int);
+int analogRead(int);
+void delay(int);
+
+void randomSeed(int);
+int random(int);
+
+unsigned long millis(); // Monotonic, unaffected by changes to the wall clock
+
+const int OUTPUT = 1;
+const int HEX = 16;
+const int SERIAL_8N1 = 0;
+
+const int RF24_1MBPS = 0;
+const int RF24_2MBPS = 1;
+const int RF24_250KBPS = 2;
+const int RF24_PA_MIN = 0;
+const int RF24_PA_LOW = 1;
+const int RF24_PA_HIGH = 2;
+const int RF24_PA_MAX = 3;
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * Nightlight controller as a Linux process, with a simulated radio: a PTY,
+ * FIFO or socket carrying the frames of host/RF24.h.
+ *
+ *   nightlight-host -r /dev/pts/3 [-s /dev/ttyAMA0] [-a address] [-c working channel]
+ *
+ * Serial commands are read from stdin (or the -s tty) and answered on stdout,
+ * in the same format as on the Arduino.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "NightlightHost.h"
+
+// The broadcast address defines the address space
+Nightlight nightlight(0x26B8259100LL);
+
+FriendList friendList;
+ControllerState controllerState;
+
+int main(int argc, char **argv)
+{
+  const char *radio = 0;
+  int option;
+
+  while((option = getopt(argc, argv, "r:s:a:c:")) != -1) {
+    switch(option) {
+      case 'r':
+        radio = optarg;
+        break;
+      case 's':
+        if(!hostOpenSerial(optarg)) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      case 'a':
+        nightlight._myAddressOffset = atoi(optarg);
+        break;
+      case 'c':
+        controllerState.setWorkingChannel(atoi(optarg));
+        break;
+      default:
+        fprintf(stderr, "usage: %s -r radio [-s serial] [-a address] [-c channel]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if(!radio) {
+    fprintf(stderr, "usage: %s -r radio [-s serial] [-a address] [-c channel]\n", argv[0]);
+    return 1;
+  }
+  if(!hostOpenRadio(radio)) {
+    perror(radio);
+    return 1;
+  }
+
+  nightlight.enableSerial();
+  nightlight.setup();
+
+  // FriendList sits underneath, so that it sees the HELLOs the controller passes on
+  nightlight.pushState(&friendList);
+  nightlight.pushState(&controllerState);
+
+  hostRun(&nightlight);
+  return 0;
+}
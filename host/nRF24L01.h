@@ -0,0 +1,10 @@
+// nRF24L01 register map for the Linux host port, only the registers Nightlight reads
+
+#ifndef NRF24L01_h
+#define NRF24L01_h
+
+#define OBSERVE_TX 0x08
+#define PLOS_CNT 4
+#define ARC_CNT 0
+
+#endif
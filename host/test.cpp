@@ -0,0 +1,232 @@
+/*
+ * End-to-end test of the Linux host port.
+ *
+ * Runs nightlight-host with a PTY pair as its radio and another as its serial
+ * port, plays an open node on the radio side, and checks that the controller
+ * takes control of it, forwards a serial command, and idles without spinning.
+ *
+ *   host-test ./build/nightlight-host
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+typedef unsigned char byte;
+
+#include "NightlightMessages.h"
+
+const uint64_t BROADCAST = 0x26B8259100LL;
+const byte CHANNEL = 76;        // CHANNEL_RENDEZVOUS
+const byte CONTROLLER = 250;
+const byte NODE = 5;
+
+static int failures = 0;
+
+#define CHECK(condition) do { if(!(condition)) { printf("%s:%d: expected %s\n", __FILE__, __LINE__, #condition); failures++; } } while(0)
+
+static long long micros() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Open a raw PTY pair, returning the master and leaving the slave open in *slave
+ */
+static int openPty(char *name, int *slave) {
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  struct termios tio;
+
+  grantpt(master);
+  unlockpt(master);
+  strcpy(name, ptsname(master));
+
+  // Raw before the child opens it, so nothing written early is mangled
+  *slave = open(name, O_RDWR | O_NOCTTY);
+  tcgetattr(*slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(*slave, TCSANOW, &tio);
+  return master;
+}
+
+static void sendFrame(int fd, byte address, const byte *packet, byte length) {
+  byte frame[40];
+  uint64_t pipe = BROADCAST + address;
+  int i;
+
+  frame[0] = 0xA5;
+  frame[1] = length;
+  frame[2] = CHANNEL;
+  for(i=0; i<5; i++) frame[3+i] = pipe >> (8*i);
+  memcpy(frame + 8, packet, length);
+  if(write(fd, frame, 8 + length) != 8 + length) failures++;
+}
+
+/**
+ * Read frames until one of the given type arrives, returning its payload length, or 0 on timeout
+ */
+static int expectFrame(int fd, byte type, byte *address, byte *packet, int timeout) {
+  static byte buffer[512];
+  static int length = 0;
+  struct pollfd in = { fd, POLLIN, 0 };
+  long long end = micros() + timeout * 1000LL;
+  int n;
+
+  for(;;) {
+    while(length >= 8) {
+      if(buffer[0] != 0xA5) {
+        memmove(buffer, buffer + 1, --length);
+        continue;
+      }
+      int size = 8 + buffer[1];
+      if(length < size) break;
+
+      bool match = buffer[8] == type;
+      if(match) {
+        *address = buffer[3];
+        memcpy(packet, buffer + 8, buffer[1]);
+        n = buffer[1];
+      }
+      length -= size;
+      memmove(buffer, buffer + size, length);
+      if(match) return n;
+    }
+
+    int wait = (end - micros()) / 1000;
+    if(wait <= 0 || poll(&in, 1, wait) <= 0) return 0;
+    n = read(fd, buffer + length, sizeof(buffer) - length);
+    if(n <= 0) return 0;
+    length += n;
+  }
+}
+
+/**
+ * Read serial output until a line containing text arrives
+ */
+static bool expectLine(int fd, const char *text, int timeout) {
+  static char buffer[1024];
+  static int length = 0;
+  struct pollfd in = { fd, POLLIN, 0 };
+  long long end = micros() + timeout * 1000LL;
+  char *found;
+  int n;
+
+  for(;;) {
+    buffer[length] = 0;
+    if((found = strstr(buffer, text))) {
+      // Drop everything up to the end of the match
+      length -= found + strlen(text) - buffer;
+      memmove(buffer, found + strlen(text), length);
+      return true;
+    }
+
+    int wait = (end - micros()) / 1000;
+    if(wait <= 0 || poll(&in, 1, wait) <= 0) return false;
+    n = read(fd, buffer + length, sizeof(buffer) - 1 - length);
+    if(n <= 0) return false;
+    length += n;
+  }
+}
+
+/**
+ * CPU time used by a process, in clock ticks
+ */
+static long cpuTicks(pid_t pid) {
+  char path[64], stat[1024];
+  unsigned long utime, stime;
+  FILE *f;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  if(!(f = fopen(path, "r"))) return -1;
+  size_t n = fread(stat, 1, sizeof(stat) - 1, f);
+  fclose(f);
+  stat[n] = 0;
+
+  // Fields 14 and 15, counted after the parenthesised command name
+  char *p = strrchr(stat, ')');
+  if(!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) return -1;
+  return utime + stime;
+}
+
+int main(int argc, char **argv) {
+  char radioName[64], serialName[64], address[8];
+  int radioSlave, serialSlave;
+  byte packet[32], to;
+  int n;
+
+  if(argc < 2) {
+    fprintf(stderr, "usage: %s nightlight-host\n", argv[0]);
+    return 2;
+  }
+
+  int radio = openPty(radioName, &radioSlave);
+  int serial = openPty(serialName, &serialSlave);
+
+  pid_t pid = fork();
+  if(pid == 0) {
+    snprintf(address, sizeof(address), "%d", CONTROLLER);
+    execl(argv[1], argv[1], "-r", radioName, "-s", serialName, "-a", address, (char *)0);
+    perror(argv[1]);
+    _exit(127);
+  }
+
+  CHECK(expectLine(serial, "00 My address is 250", 2000));
+
+  // An open node says hello, and is asked to be controlled
+  byte hello[] = { MSG_HELLO, NODE, HelloMessage::LENGTH, 1, 20 };
+  sendFrame(radio, 0, hello, sizeof(hello));
+  n = expectFrame(radio, MSG_CONTROL_REQUEST, &to, packet, 1000);
+  CHECK(n >= MESSAGE_HEADER_LENGTH);
+  CHECK(to == NODE);
+  CHECK(packet[1] == CONTROLLER);
+
+  byte start[] = { MSG_CONTROL_START, NODE, 0 };
+  sendFrame(radio, CONTROLLER, start, sizeof(start));
+
+  // Nothing to do but the controller's own timer; the process should sleep
+  usleep(100000);
+  long before = cpuTicks(pid);
+  usleep(1000000);
+  long idle = cpuTicks(pid) - before;
+  printf("idle: %ld ticks of %ld per second\n", idle, sysconf(_SC_CLK_TCK));
+  CHECK(before >= 0);
+  CHECK(idle * 20 <= sysconf(_SC_CLK_TCK));
+
+  // A serial command is forwarded to the controlled node
+  const char *command = "10 21 64 07\n";
+  long long sent = micros();
+  if(write(serial, command, strlen(command)) != (int)strlen(command)) failures++;
+  n = expectFrame(radio, MSG_COMMAND_SEND, &to, packet, 1000);
+  long long latency = micros() - sent;
+  printf("serial to radio: %lld usec\n", latency);
+  CHECK(n == MESSAGE_HEADER_LENGTH + CommandSendMessage::LENGTH);
+  CHECK(to == NODE);
+  CHECK(packet[2] == CommandSendMessage::LENGTH);
+  CHECK(packet[3] == 0x21 && packet[4] == 0x64 && packet[5] == 0x07);
+  CHECK(latency < 50000);
+  CHECK(expectLine(serial, "00 Sending a beat to 1 nodes", 1000));
+
+  kill(pid, SIGTERM);
+  waitpid(pid, 0, 0);
+  close(radio);
+  close(serial);
+  close(radioSlave);
+  close(serialSlave);
+
+  if(failures) {
+    printf("FAILED %d\n", failures);
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,189 @@
+#include <cxxtest/TestSuite.h>
+
+#include <Nightlight.h>
+
+const Keyframe TEST_RAMP[] PROGMEM = {
+  { 1000, 255, EASE_LINEAR },
+};
+
+const Keyframe TEST_UP_DOWN[] PROGMEM = {
+  { 100, 255, EASE_LINEAR },
+  { 100, 0, EASE_LINEAR },
+};
+
+/**
+ * Animation that records what it writes rather than driving pins
+ */
+class RecordingAnimation : public Animation {
+  public:
+    int writes;
+    byte lastPin;
+    byte lastValue;
+
+    RecordingAnimation() : writes(0) {}
+
+  protected:
+    void writeChannel(byte pin, byte value) {
+      writes++;
+      lastPin = pin;
+      lastValue = value;
+    }
+};
+
+class AnimationTestSuite : public CxxTest::TestSuite 
+{
+public:
+    void testTableEndpoints( void )
+    {
+        TS_ASSERT_EQUALS( easeProgress(EASE_LINEAR, 128), 128 );
+        TS_ASSERT_EQUALS( easeProgress(EASE_IN, 0), 0 );
+        TS_ASSERT_EQUALS( easeProgress(EASE_IN, 255), 255 );
+        TS_ASSERT_EQUALS( easeProgress(EASE_OUT, 255), 255 );
+        TS_ASSERT_EQUALS( easeProgress(EASE_IN_OUT, 0), 0 );
+        TS_ASSERT( easeProgress(EASE_IN, 128) < 128 );
+        TS_ASSERT( easeProgress(EASE_OUT, 128) > 128 );
+    }
+
+    void testLinearInterpolation( void )
+    {
+        RecordingAnimation a;
+        a.addChannel(3, TEST_RAMP, 1);
+        a.reset(0);
+
+        TS_ASSERT( a.update(500) );
+        // Half way up the ramp is 127/128 before gamma; gamma brings it down
+        TS_ASSERT( a.channelOutput(0) > 0 );
+        TS_ASSERT( a.channelOutput(0) < 64 );
+
+        TS_ASSERT( !a.update(1000) );
+        TS_ASSERT_EQUALS( a.channelOutput(0), 255 );
+        TS_ASSERT_EQUALS( a.lastPin, 3 );
+    }
+
+    void testLevelScalesOutput( void )
+    {
+        RecordingAnimation a;
+        a.addChannel(3, TEST_RAMP, 1);
+        a.setParameters(127, 0);
+        a.reset(0);
+
+        TS_ASSERT( !a.update(2000) );
+        TS_ASSERT( a.channelOutput(0) < 64 );
+    }
+
+    void testModWheelSpeedsUp( void )
+    {
+        RecordingAnimation a;
+        a.addChannel(3, TEST_RAMP, 1);
+        a.setParameters(0, 255);
+        a.reset(0);
+
+        // 4x speed finishes a 1000 msec ramp in 250 msec
+        TS_ASSERT( !a.update(260) );
+    }
+
+    void testLoopsAndDelay( void )
+    {
+        RecordingAnimation a;
+        a.addChannel(1, TEST_UP_DOWN, 2, 1);
+        a.addChannel(2, TEST_UP_DOWN, 2, 0, 300);
+        a.reset(0);
+
+        // Second loop of channel 0, channel 1 still waiting
+        TS_ASSERT( a.update(300) );
+        TS_ASSERT_EQUALS( a.channelOutput(0), 255 );
+        TS_ASSERT_EQUALS( a.channelOutput(1), 0 );
+
+        TS_ASSERT( a.update(400) );
+        TS_ASSERT_EQUALS( a.channelOutput(0), 0 );
+        TS_ASSERT_EQUALS( a.channelOutput(1), 255 );
+
+        TS_ASSERT( !a.update(500) );
+    }
+
+    void testOutputOnlyWrittenOnChange( void )
+    {
+        RecordingAnimation a;
+        a.addChannel(1, TEST_RAMP, 1, 0, 1000);
+        a.reset(0);
+
+        int writes = a.writes;
+        a.update(100);
+        a.update(200);
+        TS_ASSERT_EQUALS( a.writes, writes );
+    }
+
+    void testChannelLimit( void )
+    {
+        RecordingAnimation a;
+        byte i;
+        for(i=0; i<ANIMATION_MAX_CHANNELS; i++) {
+          TS_ASSERT( a.addChannel(i, TEST_RAMP, 1) );
+        }
+        TS_ASSERT( !a.addChannel(i, TEST_RAMP, 1) );
+    }
+
+    void testRepeatedCommandsReplaceTheRunningOne( void )
+    {
+        Nightlight n(0x26B8259100LL);
+        ControlledNode controlled;
+        PulseLight pulse(5);
+        byte command[3] = { 0x10, 0, 0 };
+        int i;
+
+        n._myAddressOffset = 1;
+        n.setup();
+        controlled.setCommand(&pulse);
+        controlled.setFriend(7);
+        n.pushState(&controlled);
+
+        for(i=0; i<STATE_STACK_SIZE * 2; i++) {
+            TS_ASSERT( controlled.receiveMessage(&n, 7, MSG_COMMAND_SEND, command, 3) );
+            TS_ASSERT_EQUALS( n.numStates(), 2 );
+        }
+        TS_ASSERT( pulse._timeout != 0 );
+    }
+
+    /**
+     * Leaving control, whether released or after losing the controller, stops
+     * the command, so that it can't finish later and report to the controller
+     */
+    void testLeavingStopsTheCommand( void )
+    {
+        Nightlight n(0x26B8259100LL);
+        ControlledNode controlled;
+        RecordingAnimation light;
+        byte command[3] = { 0x10, 0, 0 };
+        unsigned long end;
+        int writes;
+
+        light.addChannel(5, TEST_RAMP, 1, 255);
+        n._myAddressOffset = 1;
+        n.setup();
+        controlled.setCommand(&light);
+        controlled.setFriend(7, 90);
+
+        // Released by the controller mid-animation
+        n.pushState(&controlled);
+        TS_ASSERT( controlled.receiveMessage(&n, 7, MSG_COMMAND_SEND, command, 3) );
+        TS_ASSERT( controlled.receiveMessage(&n, 7, MSG_CONTROL_STOP, 0, 0) );
+        TS_ASSERT_EQUALS( n.numStates(), 0 );
+
+        // The controller goes quiet mid-animation
+        n.pushState(&controlled);
+        TS_ASSERT( controlled.receiveMessage(&n, 7, MSG_COMMAND_SEND, command, 3) );
+        TS_ASSERT_EQUALS( n.channel(), 90 );
+        end = stubMillis + CONTROLLER_LOST_TIMEOUT * 2;
+        while(stubMillis < end) {
+            stubMillis++;
+            n.loop();
+        }
+        TS_ASSERT_EQUALS( n.numStates(), 0 );
+        TS_ASSERT_EQUALS( n.channel(), CHANNEL_RENDEZVOUS );
+
+        writes = light.writes;
+        stubMillis += 1000;
+        n.loop();
+        TS_ASSERT_EQUALS( light.writes, writes );
+    }
+};
@@ -0,0 +1,153 @@
+#include <cxxtest/TestSuite.h>
+
+#include <Nightlight.h>
+#include <Simulator.h>
+
+const int BEACON_SWARM_NODES = 254; // Every address but the controller's, for the longest beacon interval
+
+/**
+ * An open node that keeps track of its neighbours
+ */
+class BeaconingNode {
+  public:
+    Nightlight nightlight;
+    OpenNode openNode;
+    FriendList friendList;
+
+    BeaconingNode(byte address) : nightlight(0x26B8259100LL) {
+      openNode.setFriendList(&friendList);
+
+      nightlight._myAddressOffset = address;
+      nightlight.setup();
+      nightlight.pushState(&friendList);
+      nightlight.pushState(&openNode);
+    }
+};
+
+class BeaconTestSuite : public CxxTest::TestSuite 
+{
+public:
+    void tearDown( void )
+    {
+        RF24::simulateCollisions = false;
+    }
+
+    void testIntervalGrowsWithNeighbours( void )
+    {
+        BeaconingNode node(1);
+        byte hello[2] = { NODE_KIND_OPEN, BEACON_MIN_INTERVAL / BEACON_INTERVAL_UNIT };
+        int i;
+
+        TS_ASSERT_EQUALS( node.openNode.beaconInterval(), BEACON_MIN_INTERVAL );
+
+        for(i=2; i<100; i++) {
+            node.friendList.receiveMessage(&node.nightlight, i, MSG_HELLO, hello, 2);
+        }
+        TS_ASSERT_EQUALS( node.friendList.numFriends(), FRIENDLIST_MAX_NODES );
+        TS_ASSERT_EQUALS( node.friendList.numNeighbours(), 98 );
+        TS_ASSERT_EQUALS( node.openNode.beaconInterval(), 99 * BEACON_PER_NEIGHBOUR );
+    }
+
+    void testExpiryFollowsAdvertisedInterval( void )
+    {
+        stubMillis = 1000;
+        BeaconingNode node(1);
+        byte fast[2] = { NODE_KIND_OPEN, 20 };
+        byte slow[2] = { NODE_KIND_OPEN, 100 };
+
+        node.friendList.receiveMessage(&node.nightlight, 2, MSG_HELLO, fast, 2);
+        node.friendList.receiveMessage(&node.nightlight, 3, MSG_HELLO, slow, 2);
+        TS_ASSERT_EQUALS( node.friendList.numFriends(), 2 );
+
+        // Gone after 3 x 2 seconds, but not 3 x 10
+        stubMillis += 7000;
+        node.friendList.onTimeout(&node.nightlight);
+        TS_ASSERT_EQUALS( node.friendList.numFriends(), 1 );
+
+        stubMillis += 24000;
+        node.friendList.onTimeout(&node.nightlight);
+        TS_ASSERT_EQUALS( node.friendList.numFriends(), 0 );
+    }
+
+    /**
+     * Beacons per second across the whole swarm, once it has settled
+     */
+    double swarmBeaconRate(int numNodes)
+    {
+        Simulator sim;
+        BeaconingNode *nodes[SIMULATOR_MAX_NODES];
+        int i;
+
+        RF24::simulateCollisions = true;
+        srand(numNodes);
+
+        // All nodes boot at the same moment
+        for(i=0; i<numNodes; i++) {
+            nodes[i] = new BeaconingNode(i + 1);
+            sim.add(&nodes[i]->nightlight);
+        }
+
+        sim.run(30000);
+        unsigned long before = RF24::framesByType[MSG_HELLO];
+        sim.run(30000);
+        double rate = (RF24::framesByType[MSG_HELLO] - before) / 30.0;
+
+        // Random phase and jitter keep collisions rare, despite the simultaneous boot
+        TS_ASSERT_LESS_THAN( RF24::framesCollided * 20, RF24::framesByType[MSG_HELLO] );
+
+        for(i=0; i<numNodes; i++) delete nodes[i];
+        return rate;
+    }
+
+    void testConstantAirtimeAsSwarmGrows( void )
+    {
+        double small = swarmBeaconRate(24);
+        double medium = swarmBeaconRate(48);
+        double large = swarmBeaconRate(96);
+
+        // A fixed 2 second period would give 12, 24 and 48 beacons per second
+        double limit = 1.3 * 1000 / BEACON_PER_NEIGHBOUR;
+        TS_ASSERT_LESS_THAN( small, limit );
+        TS_ASSERT_LESS_THAN( medium, limit );
+        TS_ASSERT_LESS_THAN( large, limit );
+        TS_ASSERT_LESS_THAN( large, medium * 1.3 );
+    }
+
+    void testControllerKeepsNodesInALargeSwarm( void )
+    {
+        Simulator sim;
+        SimulatedNode *nodes[BEACON_SWARM_NODES];
+        Nightlight controller(0x26B8259100LL);
+        ControllerState controllerState;
+        int i;
+
+        controller._myAddressOffset = 255;
+        controller.setup();
+        controller.pushState(&controllerState);
+        sim.add(&controller);
+
+        for(i=0; i<BEACON_SWARM_NODES; i++) {
+            nodes[i] = new SimulatedNode(i + 1);
+            sim.add(&nodes[i]->nightlight);
+            sim.run(10);
+        }
+
+        // Every node beacons at about the longest interval, far beyond CONTROLLER_NODE_TIMEOUT...
+        sim.run(BEACON_MAX_INTERVAL * 2);
+        for(i=0; i<BEACON_SWARM_NODES; i++) {
+            TS_ASSERT_LESS_THAN_EQUALS( BEACON_MAX_INTERVAL - 2 * BEACON_PER_NEIGHBOUR, nodes[i]->openNode.beaconInterval() );
+        }
+        TS_ASSERT_EQUALS( controllerState.numControlling(), BEACON_SWARM_NODES );
+
+        // ...and none of them is taken for dead
+        unsigned long stops = RF24::framesByType[MSG_CONTROL_STOP];
+        sim.run(BEACON_MAX_INTERVAL * BEACON_EXPIRY_FACTOR * 2);
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_CONTROL_STOP], stops );
+        TS_ASSERT_EQUALS( controllerState.numControlling(), BEACON_SWARM_NODES );
+
+        for(i=0; i<BEACON_SWARM_NODES; i++) {
+            sim.remove(&nodes[i]->nightlight);
+            delete nodes[i];
+        }
+    }
+};
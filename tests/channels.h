@@ -0,0 +1,165 @@
+#include <cxxtest/TestSuite.h>
+
+#include <Nightlight.h>
+#include <Simulator.h>
+
+const byte CHANNELS_TEST_GROUPS = 4;
+
+class ChannelsTestSuite : public CxxTest::TestSuite 
+{
+public:
+    void tearDown( void )
+    {
+        RF24::simulateCollisions = false;
+    }
+
+    void testNodesFollowControllerToWorkingChannel( void )
+    {
+        Simulator sim;
+        SimulatedNode *nodes[3];
+        int i;
+
+        srand(1);
+        Nightlight controller(0x26B8259100LL);
+        ControllerState controllerState;
+        controllerState.setWorkingChannel(90);
+        controller._myAddressOffset = 250;
+        controller.setup();
+        controller.pushState(&controllerState);
+        sim.add(&controller);
+
+        for(i=0; i<3; i++) {
+            nodes[i] = new SimulatedNode(i + 1);
+            sim.add(&nodes[i]->nightlight);
+            TS_ASSERT_EQUALS( nodes[i]->nightlight.channel(), CHANNEL_RENDEZVOUS );
+        }
+
+        // Open nodes are only heard during discovery windows, so allow plenty of beacons
+        sim.run(30000);
+        TS_ASSERT_EQUALS( controllerState.numControlling(), 3 );
+        for(i=0; i<3; i++) {
+            TS_ASSERT_EQUALS( nodes[i]->nightlight.channel(), 90 );
+        }
+
+        // Commands reach the nodes on the working channel, even mid-discovery
+        RF24::resetCounters();
+        controllerState.receiveMessage(&controller, -1, MSG_COMMAND_SEND, 0, 0);
+        sim.run(10);
+        TS_ASSERT_EQUALS( controller.channel(), 90 );
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_COMMAND_START], 3 );
+
+        // Released nodes return to the rendezvous channel
+        controller.sendMessage(1, MSG_CONTROL_STOP, 0, 0);
+        sim.run(10);
+        TS_ASSERT_EQUALS( nodes[0]->nightlight.channel(), CHANNEL_RENDEZVOUS );
+        TS_ASSERT_EQUALS( nodes[1]->nightlight.channel(), 90 );
+
+        for(i=0; i<3; i++) {
+            sim.remove(&nodes[i]->nightlight);
+            delete nodes[i];
+        }
+    }
+
+    void testNodesReturnWhenControllerIsLost( void )
+    {
+        Simulator sim;
+        SimulatedNode *nodes[3];
+        int i;
+
+        srand(2);
+        Nightlight controller(0x26B8259100LL);
+        ControllerState controllerState;
+        controllerState.setWorkingChannel(90);
+        controller._myAddressOffset = 250;
+        controller.setup();
+        controller.pushState(&controllerState);
+        sim.add(&controller);
+
+        for(i=0; i<3; i++) {
+            nodes[i] = new SimulatedNode(i + 1);
+            sim.add(&nodes[i]->nightlight);
+        }
+        sim.run(30000);
+        TS_ASSERT_EQUALS( controllerState.numControlling(), 3 );
+
+        // An idle controller's beacons keep its nodes
+        sim.run(CONTROLLER_LOST_TIMEOUT * 3);
+        for(i=0; i<3; i++) {
+            TS_ASSERT( nodes[i]->controlled() );
+            TS_ASSERT_EQUALS( nodes[i]->nightlight.channel(), 90 );
+        }
+
+        // The controller goes away without sending MSG_CONTROL_STOP
+        sim.remove(&controller);
+        sim.run(CONTROLLER_LOST_TIMEOUT + CONTROLLER_BEACON_INTERVAL);
+        for(i=0; i<3; i++) {
+            TS_ASSERT( !nodes[i]->controlled() );
+            TS_ASSERT_EQUALS( nodes[i]->nightlight.channel(), CHANNEL_RENDEZVOUS );
+        }
+
+        // ...and when it comes back, it finds them on the rendezvous channel again
+        sim.add(&controller);
+        sim.run(30000);
+        TS_ASSERT_EQUALS( controllerState.numControlling(), 3 );
+        for(i=0; i<3; i++) {
+            TS_ASSERT( nodes[i]->controlled() );
+            TS_ASSERT_EQUALS( nodes[i]->nightlight.channel(), 90 );
+        }
+
+        for(i=0; i<3; i++) {
+            sim.remove(&nodes[i]->nightlight);
+            delete nodes[i];
+        }
+    }
+
+    /**
+     * Frames delivered in a second when every group sends a command every msec
+     */
+    unsigned long groupThroughput(bool separateChannels)
+    {
+        Simulator sim;
+        Nightlight *senders[CHANNELS_TEST_GROUPS];
+        Nightlight *receivers[CHANNELS_TEST_GROUPS];
+        int i, ms;
+
+        RF24::simulateCollisions = true;
+
+        for(i=0; i<CHANNELS_TEST_GROUPS; i++) {
+            senders[i] = new Nightlight(0x26B8259100LL);
+            receivers[i] = new Nightlight(0x26B8259100LL);
+            senders[i]->_myAddressOffset = 100 + i;
+            receivers[i]->_myAddressOffset = 200 + i;
+            senders[i]->setup();
+            receivers[i]->setup();
+            if(separateChannels) {
+                senders[i]->setChannel(80 + i);
+                receivers[i]->setChannel(80 + i);
+            }
+            sim.add(receivers[i]);
+        }
+
+        RF24::resetCounters();
+        for(ms=0; ms<1000; ms++) {
+            for(i=0; i<CHANNELS_TEST_GROUPS; i++) {
+                senders[i]->sendMessage(200 + i, MSG_COMMAND_SEND, 0, 0);
+            }
+            sim.run(1);
+        }
+
+        for(i=0; i<CHANNELS_TEST_GROUPS; i++) {
+            sim.remove(receivers[i]);
+            delete senders[i];
+            delete receivers[i];
+        }
+        return RF24::framesDelivered;
+    }
+
+    void testThroughputScalesWithChannels( void )
+    {
+        unsigned long shared = groupThroughput(false);
+        unsigned long separate = groupThroughput(true);
+
+        TS_ASSERT_EQUALS( shared, 1000 );
+        TS_ASSERT_EQUALS( separate, 1000 * CHANNELS_TEST_GROUPS );
+    }
+};
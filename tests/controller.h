@@ -0,0 +1,138 @@
+#include <cxxtest/TestSuite.h>
+
+#include <Nightlight.h>
+#include <Simulator.h>
+
+const int CONTROLLER_TEST_NODES = 220;
+const int CONTROLLER_SWARM_NODES = 30;
+
+class ControllerTestSuite : public CxxTest::TestSuite 
+{
+public:
+    void testNodeSet( void )
+    {
+        NodeSet set;
+        TS_ASSERT_EQUALS( set.count(), 0 );
+        TS_ASSERT_EQUALS( set.next(-1), -1 );
+
+        set.add(0);
+        set.add(9);
+        set.add(200);
+        set.add(255);
+        TS_ASSERT_EQUALS( set.count(), 4 );
+        TS_ASSERT( set.contains(200) );
+        TS_ASSERT( !set.contains(201) );
+
+        TS_ASSERT_EQUALS( set.next(-1), 0 );
+        TS_ASSERT_EQUALS( set.next(0), 9 );
+        TS_ASSERT_EQUALS( set.next(9), 200 );
+        TS_ASSERT_EQUALS( set.next(200), 255 );
+        TS_ASSERT_EQUALS( set.next(255), -1 );
+
+        set.remove(9);
+        TS_ASSERT_EQUALS( set.next(0), 200 );
+        TS_ASSERT_EQUALS( set.count(), 3 );
+    }
+
+    void testControlsManyNodesWithBoundedAirtime( void )
+    {
+        Simulator sim;
+        SimulatedNode *nodes[CONTROLLER_TEST_NODES];
+        int i;
+
+        Nightlight controller(0x26B8259100LL);
+        ControllerState controllerState;
+        controller._myAddressOffset = 250;
+        controller.setup();
+        controller.pushState(&controllerState);
+        sim.add(&controller);
+
+        // Nodes boot a few msec apart, so their HELLOs don't arrive all at once
+        RF24::resetCounters();
+        for(i=0; i<CONTROLLER_TEST_NODES; i++) {
+            nodes[i] = new SimulatedNode(i + 1);
+            sim.add(&nodes[i]->nightlight);
+            sim.run(2000 / CONTROLLER_TEST_NODES);
+        }
+
+        // Requests go out at CONTROLLER_REQUESTS_PER_INTERVAL per interval
+        sim.run(2000 - 2000 / CONTROLLER_TEST_NODES * CONTROLLER_TEST_NODES);
+        unsigned long requests = RF24::framesByType[MSG_CONTROL_REQUEST];
+        TS_ASSERT_LESS_THAN_EQUALS( requests, 2000 / CONTROLLER_REQUEST_INTERVAL * CONTROLLER_REQUESTS_PER_INTERVAL );
+        TS_ASSERT( controllerState.numControlling() > 0 );
+
+        sim.run(8000);
+        TS_ASSERT_EQUALS( controllerState.numControlling(), CONTROLLER_TEST_NODES );
+
+        // Each node was asked exactly once, despite its repeated HELLOs
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_CONTROL_REQUEST], CONTROLLER_TEST_NODES );
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_CONTROL_START], CONTROLLER_TEST_NODES );
+
+        // Nodes that leave are released
+        nodes[0]->nightlight.sendMessage(250, MSG_CONTROL_STOP, 0, 0);
+        sim.run(10);
+        TS_ASSERT( !controllerState.isControlling(1) );
+
+        for(i=0; i<CONTROLLER_TEST_NODES; i++) {
+            sim.remove(&nodes[i]->nightlight);
+            delete nodes[i];
+        }
+        sim.run(BEACON_MAX_INTERVAL * BEACON_EXPIRY_FACTOR * 2 + CONTROLLER_REQUEST_INTERVAL);
+        TS_ASSERT_EQUALS( controllerState.numControlling(), 0 );
+    }
+
+    void testNodesRejoinAfterRelease( void )
+    {
+        Simulator sim;
+        SimulatedNode *nodes[CONTROLLER_SWARM_NODES];
+        int i;
+
+        Nightlight controller(0x26B8259100LL);
+        ControllerState controllerState;
+        controller._myAddressOffset = 250;
+        controller.setup();
+        controller.pushState(&controllerState);
+        sim.add(&controller);
+
+        for(i=0; i<CONTROLLER_SWARM_NODES; i++) {
+            nodes[i] = new SimulatedNode(i + 1);
+            sim.add(&nodes[i]->nightlight);
+            sim.run(50);
+        }
+
+        // Long enough for the beacon intervals to settle
+        sim.run(BEACON_MAX_INTERVAL + CONTROLLER_NODE_TIMEOUT);
+        TS_ASSERT_EQUALS( controllerState.numControlling(), CONTROLLER_SWARM_NODES );
+
+        // The controller stops hearing beacons, and lets go of every node
+        RF24::linkLoss[0] = 100;
+        sim.run((CONTROLLER_SWARM_NODES * BEACON_PER_NEIGHBOUR * BEACON_EXPIRY_FACTOR + CONTROLLER_REQUEST_INTERVAL) * 2);
+        TS_ASSERT_EQUALS( controllerState.numControlling(), 0 );
+        TS_ASSERT_LESS_THAN_EQUALS( CONTROLLER_SWARM_NODES, RF24::framesByType[MSG_CONTROL_STOP] );
+        for(i=0; i<CONTROLLER_SWARM_NODES; i++) {
+            TS_ASSERT( !nodes[i]->controlled() );
+        }
+
+        // ...and they rejoin once it can hear them again
+        RF24::linkLoss[0] = 0;
+        sim.run(BEACON_MAX_INTERVAL);
+        TS_ASSERT_EQUALS( controllerState.numControlling(), CONTROLLER_SWARM_NODES );
+
+        // A restarted controller asks again, and nodes still under its control accept
+        controller.removeState(&controllerState);
+        controller.pushState(&controllerState);
+        sim.run(BEACON_MAX_INTERVAL);
+        TS_ASSERT_EQUALS( controllerState.numControlling(), CONTROLLER_SWARM_NODES );
+        for(i=0; i<CONTROLLER_SWARM_NODES; i++) {
+            TS_ASSERT( nodes[i]->controlled() );
+        }
+
+        // Each node was asked about once per time it joined
+        TS_ASSERT_LESS_THAN_EQUALS( RF24::framesByType[MSG_CONTROL_REQUEST], CONTROLLER_SWARM_NODES * 3 + 3 );
+
+        for(i=0; i<CONTROLLER_SWARM_NODES; i++) {
+            sim.remove(&nodes[i]->nightlight);
+            delete nodes[i];
+        }
+    }
+};
@@ -0,0 +1,113 @@
+#include <cxxtest/TestSuite.h>
+
+#include <Nightlight.h>
+#include <Simulator.h>
+
+const byte LINKS_GOOD_PEER = 2;
+const byte LINKS_LOSSY_PEER = 3;
+const byte LINKS_DEAD_PEER = 4;
+
+class LinksTestSuite : public CxxTest::TestSuite 
+{
+public:
+    /**
+     * Send commands round-robin to a good, a lossy and a dead peer.
+     * Returns the msec spent blocked in write().
+     */
+    unsigned long sendToPeers(bool adaptive, unsigned long *delivered)
+    {
+        Simulator sim;
+        Nightlight sender(0x26B8259100LL);
+        Nightlight good(0x26B8259100LL);
+        Nightlight lossy(0x26B8259100LL);
+        int i;
+
+        srand(1);
+        sender._myAddressOffset = 1;
+        good._myAddressOffset = LINKS_GOOD_PEER;
+        lossy._myAddressOffset = LINKS_LOSSY_PEER;
+        sender.setup();
+        good.setup();
+        lossy.setup();
+        sender.setLinkAdaptation(adaptive);
+        sim.add(&good);
+        sim.add(&lossy);
+
+        RF24::resetCounters();
+        RF24::linkLoss[LINKS_LOSSY_PEER] = 30;
+
+        for(i=0; i<300; i++) {
+            sender.sendMessage(LINKS_GOOD_PEER, MSG_COMMAND_SEND, 0, 0);
+            sender.sendMessage(LINKS_LOSSY_PEER, MSG_COMMAND_SEND, 0, 0);
+            sender.sendMessage(LINKS_DEAD_PEER, MSG_COMMAND_SEND, 0, 0);
+            sim.run(1);
+        }
+
+        *delivered = RF24::framesDelivered;
+        return RF24::blockedMicros / 1000;
+    }
+
+    void testStatistics( void )
+    {
+        Nightlight sender(0x26B8259100LL);
+        Nightlight good(0x26B8259100LL);
+        int i;
+
+        sender._myAddressOffset = 1;
+        good._myAddressOffset = LINKS_GOOD_PEER;
+        sender.setup();
+        good.setup();
+
+        TS_ASSERT_IS_NULL( sender.linkStats(LINKS_GOOD_PEER) );
+
+        for(i=0; i<20; i++) {
+            sender.sendMessage(LINKS_GOOD_PEER, MSG_COMMAND_SEND, 0, 0);
+            sender.sendMessage(LINKS_DEAD_PEER, MSG_COMMAND_SEND, 0, 0);
+            good.loop();
+        }
+
+        const LinkStats *stats = sender.linkStats(LINKS_GOOD_PEER);
+        TS_ASSERT_IS_NOT_NULL( stats );
+        TS_ASSERT_EQUALS( stats->sent, 20 );
+        TS_ASSERT_EQUALS( stats->failed, 0 );
+        TS_ASSERT( stats->successRatio > LINK_GOOD );
+        TS_ASSERT( stats->retries < 4 );
+
+        stats = sender.linkStats(LINKS_DEAD_PEER);
+        TS_ASSERT_EQUALS( stats->failed, 20 );
+        TS_ASSERT( stats->successRatio < LINK_POOR );
+
+        // Broadcasts don't have a link
+        sender.sendMessage(0, MSG_COMMAND_SEND, 0, 0);
+        TS_ASSERT_IS_NULL( sender.linkStats(0) );
+    }
+
+    void testLeastRecentlyUsedPeerForgotten( void )
+    {
+        Nightlight sender(0x26B8259100LL);
+        sender._myAddressOffset = 1;
+        sender.setup();
+        int i;
+
+        for(i=0; i<LINK_TABLE_SIZE + 1; i++) {
+            sender.sendMessage(10 + i, MSG_COMMAND_SEND, 0, 0);
+        }
+        TS_ASSERT_IS_NULL( sender.linkStats(10) );
+        TS_ASSERT_IS_NOT_NULL( sender.linkStats(11) );
+        TS_ASSERT_IS_NOT_NULL( sender.linkStats(10 + LINK_TABLE_SIZE) );
+    }
+
+    void testAdaptationReducesBlockedTime( void )
+    {
+        unsigned long fixedDelivered, adaptiveDelivered;
+        unsigned long fixed = sendToPeers(false, &fixedDelivered);
+        unsigned long adaptive = sendToPeers(true, &adaptiveDelivered);
+
+        // Mostly the dead peer's retries, at 4 msec each
+        TS_ASSERT( fixed > 300 * 15 * 4 );
+        TS_ASSERT_LESS_THAN( adaptive * 10, fixed );
+
+        // ...without losing more than a few frames to the lossy peer
+        TS_ASSERT_LESS_THAN( fixedDelivered, adaptiveDelivered + 10 );
+    }
+};
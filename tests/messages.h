@@ -0,0 +1,178 @@
+#include <cxxtest/TestSuite.h>
+
+#include <Nightlight.h>
+#include <Simulator.h>
+
+/**
+ * Records the messages that reach it
+ */
+class RecordingState : public NightlightState {
+  public:
+    RecordingState() : received(0), lastType(0), lastLength(0) {}
+
+    virtual bool receiveMessage(Nightlight *me, int sender, byte type, byte *data, byte dataLength) {
+      received++;
+      lastType = type;
+      lastLength = dataLength;
+      memcpy(lastData, data, dataLength);
+      return true;
+    }
+
+    int received;
+    byte lastType;
+    byte lastLength;
+    byte lastData[32];
+};
+
+class MessagesTestSuite : public CxxTest::TestSuite
+{
+public:
+    void testViews( void )
+    {
+        byte hello[2] = { NODE_KIND_OPEN, 20 };
+
+        const HelloMessage *view = messageView<HelloMessage>(MSG_HELLO, hello, 2);
+        TS_ASSERT(view);
+        TS_ASSERT_EQUALS(view->kind, NODE_KIND_OPEN);
+        TS_ASSERT_EQUALS(view->interval, 20);
+
+        // Too short, or not a HELLO
+        TS_ASSERT(!messageView<HelloMessage>(MSG_HELLO, hello, 1));
+        TS_ASSERT(!messageView<HelloMessage>(MSG_APPEAR, hello, 2));
+
+        TS_ASSERT_EQUALS(messageMinLength(MSG_HELLO), 2);
+        TS_ASSERT_EQUALS(messageMinLength(MSG_CONTROL_REQUEST), 0);
+        TS_ASSERT_EQUALS(messageLength(MSG_CONTROL_REQUEST), ControlRequestMessage::LENGTH);
+        TS_ASSERT_EQUALS(messageMinLength(MSG_COMMAND_END), 0);
+        TS_ASSERT_EQUALS(messageLength(MSG_COMMAND_END), 0);
+    }
+
+    /**
+     * Frames that leave out optional fields reach states with them filled in,
+     * from the radio or from this node
+     */
+    void testOptionalFieldsFilledIn( void )
+    {
+        Simulator sim;
+        Nightlight receiver(0x26B8259100LL);
+        RecordingState recorder;
+        RF24 raw(9, 10);
+
+        receiver._myAddressOffset = 2;
+        receiver.setup();
+        receiver.pushState(&recorder);
+        sim.add(&receiver);
+
+        raw.begin();
+        raw.enableDynamicPayloads();
+        raw.setChannel(CHANNEL_RENDEZVOUS);
+        raw.openWritingPipe(0x26B8259100LL + 2);
+
+        byte request[3] = { MSG_CONTROL_REQUEST, 3, 0 };
+        raw.write(request, 3);
+        sim.run(1);
+        TS_ASSERT_EQUALS(recorder.received, 1);
+        TS_ASSERT_EQUALS(recorder.lastLength, ControlRequestMessage::LENGTH);
+        TS_ASSERT_EQUALS(recorder.lastData[0], CHANNEL_NONE);
+
+        byte command[4] = { MSG_COMMAND_SEND, 3, 1, 0x21 };
+        raw.write(command, 4);
+        sim.run(1);
+        TS_ASSERT_EQUALS(recorder.received, 2);
+        const CommandSendMessage *view = messageView<CommandSendMessage>(recorder.lastType, recorder.lastData, recorder.lastLength);
+        TS_ASSERT(view);
+        TS_ASSERT_EQUALS(view->command, 0x21);
+        TS_ASSERT_EQUALS(view->level, 0);
+        TS_ASSERT_EQUALS(view->modWheel, 0);
+
+        receiver.sendMessage(2, MSG_CONTROL_REQUEST, 0, 0);
+        TS_ASSERT_EQUALS(recorder.received, 3);
+        TS_ASSERT_EQUALS(recorder.lastLength, ControlRequestMessage::LENGTH);
+        TS_ASSERT_EQUALS(recorder.lastData[0], CHANNEL_NONE);
+
+        // Messages to this node are checked as radio frames are
+        byte kind = NODE_KIND_OPEN;
+        receiver.sendMessage(2, MSG_HELLO, &kind, 1);
+        TS_ASSERT_EQUALS(recorder.received, 3);
+        TS_ASSERT_EQUALS(receiver.rejectedFrames(), 0);
+    }
+
+    void testRoundTrip( void )
+    {
+        Simulator sim;
+        Nightlight sender(0x26B8259100LL);
+        Nightlight receiver(0x26B8259100LL);
+        RecordingState recorder;
+
+        sender._myAddressOffset = 1;
+        receiver._myAddressOffset = 2;
+        sender.setup();
+        receiver.setup();
+        receiver.pushState(&recorder);
+        sim.add(&receiver);
+
+        CommandSendMessage command = { 0x21, 100, 7 };
+        sender.send(2, command);
+        sim.run(1);
+
+        TS_ASSERT_EQUALS(recorder.received, 1);
+        TS_ASSERT_EQUALS(recorder.lastType, MSG_COMMAND_SEND);
+        TS_ASSERT_EQUALS(recorder.lastLength, CommandSendMessage::LENGTH);
+        const CommandSendMessage *view = messageView<CommandSendMessage>(recorder.lastType, recorder.lastData, recorder.lastLength);
+        TS_ASSERT(view);
+        TS_ASSERT_EQUALS(view->command, 0x21);
+        TS_ASSERT_EQUALS(view->level, 100);
+        TS_ASSERT_EQUALS(view->modWheel, 7);
+
+        // Data that doesn't fit in a frame is never sent
+        byte big[32] = { 0 };
+        sender.sendMessage(2, MSG_EVENT, big, MESSAGE_MAX_DATA + 1);
+        sim.run(1);
+        TS_ASSERT_EQUALS(recorder.received, 1);
+    }
+
+    void testMalformedFramesRejected( void )
+    {
+        Simulator sim;
+        Nightlight receiver(0x26B8259100LL);
+        RecordingState recorder;
+        RF24 raw(9, 10);
+
+        receiver._myAddressOffset = 2;
+        receiver.setup();
+        receiver.pushState(&recorder);
+        sim.add(&receiver);
+
+        raw.begin();
+        raw.enableDynamicPayloads();
+        raw.setChannel(CHANNEL_RENDEZVOUS);
+        raw.openWritingPipe(0x26B8259100LL + 2);
+
+        // Shorter than a header
+        byte runt[2] = { MSG_EVENT, 3 };
+        raw.write(runt, 2);
+        sim.run(1);
+
+        // Length byte claims more data than the frame has
+        byte overrun[5] = { MSG_EVENT, 3, 10, 1, 2 };
+        raw.write(overrun, 5);
+        sim.run(1);
+
+        // HELLO without its interval
+        byte hello[4] = { MSG_HELLO, 3, 1, NODE_KIND_OPEN };
+        raw.write(hello, 4);
+        sim.run(1);
+
+        TS_ASSERT_EQUALS(recorder.received, 0);
+        TS_ASSERT_EQUALS(receiver.rejectedFrames(), 3);
+
+        // A well-formed frame still gets through
+        byte event[5] = { MSG_EVENT, 3, 2, 1, 2 };
+        raw.write(event, 5);
+        sim.run(1);
+
+        TS_ASSERT_EQUALS(recorder.received, 1);
+        TS_ASSERT_EQUALS(recorder.lastLength, 2);
+        TS_ASSERT_EQUALS(receiver.rejectedFrames(), 3);
+    }
+};
@@ -12,5 +12,28 @@ public:
         TS_ASSERT( 1 + 1 > 1 );
         TS_ASSERT_EQUALS( 1 + 1, 2 );
     }
+
+    void testNextTimeout( void )
+    {
+        Nightlight n(12345);
+        ControllerState controller;
+        n._myAddressOffset = 1;
+        TS_ASSERT_EQUALS( n.nextTimeout(), NO_TIMEOUT );
+
+        n.pushState(&controller);
+        TS_ASSERT_EQUALS( n.nextTimeout(), CONTROLLER_REQUEST_INTERVAL + 1 );
+
+        stubMillis += CONTROLLER_REQUEST_INTERVAL;
+        TS_ASSERT_EQUALS( n.nextTimeout(), 1 );
+        stubMillis += 1;
+        TS_ASSERT_EQUALS( n.nextTimeout(), 0 );
+        n.loop();
+        TS_ASSERT_EQUALS( n.nextTimeout(), CONTROLLER_REQUEST_INTERVAL + 1 );
+
+        // Deferred frames are retried as the budget refills
+        n.setBudget(PRIORITY_TELEMETRY, 0, 0);
+        n.sendMessage(0, MSG_EVENT, 0, 0);
+        TS_ASSERT_EQUALS( n.nextTimeout(), BUDGET_REFILL_PERIOD );
+    }
 };
 
@@ -0,0 +1,394 @@
+#include <cxxtest/TestSuite.h>
+
+#include <Nightlight.h>
+#include <Simulator.h>
+#include <EEPROM.h>
+
+// Two outputs pulsing, the second delayed and playing once
+const byte PATTERN_TEST_PULSE[] = {
+  2,
+  0, 2, 0, 0, 2,    150, 0, 255, EASE_OUT,   94, 1, 0, EASE_IN,
+  1, 0, 100, 0, 2,  150, 0, 255, EASE_OUT,   94, 1, 0, EASE_IN,
+};
+
+const Keyframe PATTERN_TEST_KEYFRAMES[] PROGMEM = {
+  { 150, 255, EASE_OUT },
+  { 350, 0, EASE_IN },
+};
+
+const byte PATTERN_TEST_PINS[] = { 5, 6 };
+
+class PatternsTestSuite : public CxxTest::TestSuite
+{
+public:
+    void setUp()
+    {
+        EEPROM.erase();
+    }
+
+    uint16_t crc(const byte *data, unsigned int length)
+    {
+        uint16_t crc = 0xFFFF;
+        for(unsigned int i=0; i<length; i++) crc = crc16Update(crc, data[i]);
+        return crc;
+    }
+
+    /**
+     * Stream a pattern into a store in radio-sized chunks
+     */
+    bool store(PatternStore *store, byte command, const byte *data, unsigned int length)
+    {
+        unsigned int offset;
+        if(!store->beginPattern(command, length, crc(data, length))) return false;
+        for(offset=0; offset<length; offset+=PATTERN_CHUNK_LENGTH) {
+            byte chunk = length - offset < PATTERN_CHUNK_LENGTH ? length - offset : PATTERN_CHUNK_LENGTH;
+            if(!store->writePattern(offset, data + offset, chunk)) return false;
+        }
+        return store->endPattern();
+    }
+
+    bool matches(PatternStore *store, byte command, const byte *data, unsigned int length)
+    {
+        int index = store->find(command);
+        if(index < 0 || store->entry(index)->length != length) return false;
+        for(unsigned int i=0; i<length; i++) {
+            if(store->read(store->patternAddress(index) + i) != data[i]) return false;
+        }
+        return true;
+    }
+
+    void testStoreAndReload( void )
+    {
+        PatternStore patterns;
+        byte data[60];
+        for(int i=0; i<60; i++) data[i] = i * 7;
+
+        patterns.load();
+        TS_ASSERT_EQUALS( patterns.numPatterns(), 0 );
+
+        TS_ASSERT( store(&patterns, 0x21, data, sizeof(data)) );
+        TS_ASSERT( matches(&patterns, 0x21, data, sizeof(data)) );
+        TS_ASSERT_EQUALS( patterns.find(0x22), -1 );
+
+        // Each byte is written once
+        TS_ASSERT_LESS_THAN_EQUALS( EEPROM.writes, PATTERN_HEADER_LENGTH + sizeof(data) );
+
+        // After a reset
+        PatternStore reloaded;
+        reloaded.load();
+        TS_ASSERT_EQUALS( reloaded.numPatterns(), 1 );
+        TS_ASSERT( matches(&reloaded, 0x21, data, sizeof(data)) );
+    }
+
+    void testBankSelection( void )
+    {
+        PatternStore patterns;
+        patterns.load();
+        store(&patterns, 0x20, PATTERN_TEST_PULSE, sizeof(PATTERN_TEST_PULSE));
+        store(&patterns, 0x23, PATTERN_TEST_PULSE, sizeof(PATTERN_TEST_PULSE));
+        store(&patterns, 0x31, PATTERN_TEST_PULSE, sizeof(PATTERN_TEST_PULSE));
+
+        TS_ASSERT_EQUALS( patterns.select(0x23), patterns.find(0x23) );
+
+        // Missing options play another pattern from the same bank
+        TS_ASSERT_EQUALS( patterns.select(0x21), patterns.find(0x23) );
+        TS_ASSERT_EQUALS( patterns.select(0x22), patterns.find(0x20) );
+        TS_ASSERT_EQUALS( patterns.select(0x3F), patterns.find(0x31) );
+        TS_ASSERT_EQUALS( patterns.select(0x40), -1 );
+    }
+
+    void testFailedTransferKeepsOldPattern( void )
+    {
+        PatternStore patterns;
+        byte v1[40], v2[40];
+        for(int i=0; i<40; i++) {
+            v1[i] = i;
+            v2[i] = 100 + i;
+        }
+        patterns.load();
+        TS_ASSERT( store(&patterns, 0x10, v1, sizeof(v1)) );
+
+        // Out of order
+        TS_ASSERT( patterns.beginPattern(0x10, sizeof(v2), crc(v2, sizeof(v2))) );
+        TS_ASSERT( !patterns.writePattern(5, v2, 10) );
+        TS_ASSERT( !patterns.writing() );
+        TS_ASSERT( matches(&patterns, 0x10, v1, sizeof(v1)) );
+
+        // Corrupted
+        TS_ASSERT( patterns.beginPattern(0x10, sizeof(v2), crc(v1, sizeof(v1))) );
+        TS_ASSERT( patterns.writePattern(0, v2, sizeof(v2)) );
+        TS_ASSERT( !patterns.endPattern() );
+        TS_ASSERT( matches(&patterns, 0x10, v1, sizeof(v1)) );
+
+        // Reset half way through
+        TS_ASSERT( patterns.beginPattern(0x10, sizeof(v2), crc(v2, sizeof(v2))) );
+        TS_ASSERT( patterns.writePattern(0, v2, 30) );
+        PatternStore reloaded;
+        reloaded.load();
+        TS_ASSERT( matches(&reloaded, 0x10, v1, sizeof(v1)) );
+
+        TS_ASSERT( store(&reloaded, 0x10, v2, sizeof(v2)) );
+        PatternStore replaced;
+        replaced.load();
+        TS_ASSERT_EQUALS( replaced.numPatterns(), 1 );
+        TS_ASSERT( matches(&replaced, 0x10, v2, sizeof(v2)) );
+    }
+
+    void testFull( void )
+    {
+        PatternStore patterns;
+        byte data[20] = { 0 };
+        int i;
+        patterns.load();
+
+        TS_ASSERT( !patterns.beginPattern(0x10, PATTERN_STORE_SIZE, 0) );
+
+        for(i=0; i<PATTERN_MAX_ENTRIES; i++) {
+            TS_ASSERT( store(&patterns, i, data, sizeof(data)) );
+        }
+        TS_ASSERT( !patterns.beginPattern(0xF0, sizeof(data), crc(data, sizeof(data))) );
+
+        // Replacing a pattern still works
+        data[0] = 1;
+        TS_ASSERT( store(&patterns, 3, data, sizeof(data)) );
+        TS_ASSERT_EQUALS( patterns.numPatterns(), PATTERN_MAX_ENTRIES );
+    }
+
+    void testWritesAreSpreadOut( void )
+    {
+        PatternStore patterns;
+        byte data[100];
+        unsigned long maxWear = 0;
+        int round, i;
+        patterns.load();
+        TS_ASSERT( store(&patterns, 0x20, PATTERN_TEST_PULSE, sizeof(PATTERN_TEST_PULSE)) );
+
+        for(round=0; round<200; round++) {
+            for(i=0; i<100; i++) data[i] = round + i;
+            TS_ASSERT( store(&patterns, 0x10, data, sizeof(data)) );
+        }
+
+        for(i=0; i<(int)EEPROM_STUB_SIZE; i++) {
+            if(EEPROM.wear[i] > maxWear) maxWear = EEPROM.wear[i];
+        }
+        TS_ASSERT_LESS_THAN_EQUALS( maxWear, 200 / 4 );
+
+        PatternStore reloaded;
+        reloaded.load();
+        TS_ASSERT_EQUALS( reloaded.numPatterns(), 2 );
+        TS_ASSERT( matches(&reloaded, 0x10, data, sizeof(data)) );
+        TS_ASSERT( matches(&reloaded, 0x20, PATTERN_TEST_PULSE, sizeof(PATTERN_TEST_PULSE)) );
+    }
+
+    void testPlaysLikeProgmemAnimation( void )
+    {
+        PatternStore patterns;
+        PatternPlayer player;
+        Animation reference;
+        unsigned long now;
+
+        patterns.load();
+        TS_ASSERT( store(&patterns, 0x42, PATTERN_TEST_PULSE, sizeof(PATTERN_TEST_PULSE)) );
+        player.setStore(&patterns);
+        player.setPins(PATTERN_TEST_PINS, 2);
+        TS_ASSERT( player.load(0x42) );
+        TS_ASSERT( !player.load(0x50) );
+        TS_ASSERT( player.load(0x42) );
+
+        reference.addChannel(5, PATTERN_TEST_KEYFRAMES, 2, 2, 0);
+        reference.addChannel(6, PATTERN_TEST_KEYFRAMES, 2, 0, 100);
+
+        player.reset(0);
+        reference.reset(0);
+        unsigned long misses = patterns.cacheMisses();
+        for(now=FRAME_LENGTH; now<2000; now+=FRAME_LENGTH) {
+            TS_ASSERT_EQUALS( player.update(now), reference.update(now) );
+            TS_ASSERT_EQUALS( player.channelOutput(0), reference.channelOutput(0) );
+            TS_ASSERT_EQUALS( player.channelOutput(1), reference.channelOutput(1) );
+        }
+
+        // The whole pattern fits in the cache
+        TS_ASSERT_LESS_THAN_EQUALS( patterns.cacheMisses() - misses, PATTERN_CACHE_LINES );
+    }
+
+    /**
+     * Replacing a pattern while it plays, then storing another, mustn't
+     * overwrite the keyframes that are still being read
+     */
+    void testReplacingAPlayingPattern( void )
+    {
+        // Room for exactly two copies of the pattern
+        const unsigned int pages = (PATTERN_HEADER_LENGTH + sizeof(PATTERN_TEST_PULSE) + PATTERN_PAGE_SIZE - 1) / PATTERN_PAGE_SIZE;
+        PatternStore patterns(0, pages * 2 * PATTERN_PAGE_SIZE);
+        PatternPlayer player;
+        Animation reference;
+        byte replacement[sizeof(PATTERN_TEST_PULSE)], other[sizeof(PATTERN_TEST_PULSE)];
+        unsigned long now;
+
+        memcpy(replacement, PATTERN_TEST_PULSE, sizeof(replacement));
+        replacement[6] = 100;
+        memcpy(other, PATTERN_TEST_PULSE, sizeof(other));
+        other[8] = 100;
+
+        patterns.load();
+        TS_ASSERT( store(&patterns, 0x42, PATTERN_TEST_PULSE, sizeof(PATTERN_TEST_PULSE)) );
+        player.setStore(&patterns);
+        player.setPins(PATTERN_TEST_PINS, 2);
+        TS_ASSERT( player.load(0x42) );
+
+        // The first channel loops, so its keyframes are read again as it plays
+        reference.addChannel(5, PATTERN_TEST_KEYFRAMES, 2, 2, 0);
+        reference.addChannel(6, PATTERN_TEST_KEYFRAMES, 2, 0, 100);
+        player.reset(0);
+        reference.reset(0);
+
+        TS_ASSERT( store(&patterns, 0x42, replacement, sizeof(replacement)) );
+
+        // The only free pages are the old pattern's, which is still playing
+        TS_ASSERT( !store(&patterns, 0x50, other, sizeof(other)) );
+        for(now=FRAME_LENGTH; now<2000; now+=FRAME_LENGTH) {
+            TS_ASSERT_EQUALS( player.update(now), reference.update(now) );
+            TS_ASSERT_EQUALS( player.channelOutput(0), reference.channelOutput(0) );
+            TS_ASSERT_EQUALS( player.channelOutput(1), reference.channelOutput(1) );
+        }
+
+        // Once the player moves on to the new version, the old one's room is free
+        TS_ASSERT( player.load(0x42) );
+        TS_ASSERT( store(&patterns, 0x50, other, sizeof(other)) );
+        TS_ASSERT( matches(&patterns, 0x42, replacement, sizeof(replacement)) );
+        TS_ASSERT( matches(&patterns, 0x50, other, sizeof(other)) );
+    }
+
+    void testControlledNodePlaysStoredPattern( void )
+    {
+        Nightlight n(0x26B8259100LL);
+        PatternStore patterns;
+        PatternPlayer player;
+        ControlledNode controlled;
+        BlinkyLight blinky;
+        byte command[3] = { 0x42, 0, 0 };
+
+        n._myAddressOffset = 1;
+        n.setup();
+        patterns.load();
+        store(&patterns, 0x42, PATTERN_TEST_PULSE, sizeof(PATTERN_TEST_PULSE));
+        player.setStore(&patterns);
+        player.setPins(PATTERN_TEST_PINS, 2);
+
+        controlled.setCommand(&blinky);
+        controlled.setPatterns(&player);
+        controlled.setFriend(7);
+
+        controlled.receiveMessage(&n, 7, MSG_COMMAND_SEND, command, 3);
+        TS_ASSERT( player._timeout != 0 );
+        TS_ASSERT_EQUALS( blinky._timeout, 0 );
+
+        // Nothing stored in bank 5
+        command[0] = 0x50;
+        controlled.receiveMessage(&n, 7, MSG_COMMAND_SEND, command, 3);
+        TS_ASSERT( blinky._timeout != 0 );
+    }
+
+    void testRepeatedPatternCommandsReplaceTheRunningOne( void )
+    {
+        Nightlight n(0x26B8259100LL);
+        PatternStore patterns;
+        PatternPlayer player;
+        ControlledNode controlled;
+        BlinkyLight blinky;
+        byte command[3] = { 0x42, 0, 0 };
+        int i;
+
+        n._myAddressOffset = 1;
+        n.setup();
+        patterns.load();
+        store(&patterns, 0x42, PATTERN_TEST_PULSE, sizeof(PATTERN_TEST_PULSE));
+        player.setStore(&patterns);
+        player.setPins(PATTERN_TEST_PINS, 2);
+
+        controlled.setCommand(&blinky);
+        controlled.setPatterns(&player);
+        controlled.setFriend(7);
+        n.pushState(&controlled);
+
+        // Alternating between a stored pattern and the command state
+        for(i=0; i<STATE_STACK_SIZE * 2; i++) {
+            command[0] = (i & 1) ? 0x50 : 0x42;
+            controlled.receiveMessage(&n, 7, MSG_COMMAND_SEND, command, 3);
+            TS_ASSERT_EQUALS( n.numStates(), 2 );
+        }
+    }
+
+    void testOverTheAir( void )
+    {
+        Simulator sim;
+        Nightlight controller(0x26B8259100LL);
+        Nightlight node(0x26B8259100LL);
+        PatternSender sender;
+        PatternReceiver receiver;
+        PatternStore patterns;
+        byte data[150];
+        int i;
+        for(i=0; i<150; i++) data[i] = i ^ 0x55;
+
+        controller._myAddressOffset = 1;
+        node._myAddressOffset = 2;
+        controller.setup();
+        node.setup();
+        patterns.load();
+        receiver.setStore(&patterns);
+        node.pushState(&receiver);
+        sim.add(&controller);
+        sim.add(&node);
+
+        sender.setPattern(2, 0x42, data, sizeof(data));
+        controller.pushState(&sender);
+        TS_ASSERT_EQUALS( sender.status(), PATTERN_PENDING );
+
+        sim.run(5000);
+        TS_ASSERT_EQUALS( sender.status(), PATTERN_OK );
+        TS_ASSERT( matches(&patterns, 0x42, data, sizeof(data)) );
+        TS_ASSERT_EQUALS( controller.trafficStats(PRIORITY_TELEMETRY)->dropped, 0 );
+    }
+
+    /**
+     * Bursts of events share the transfer's budget, and overflow the send
+     * queue; chunks must still all arrive, in order
+     */
+    void testOverTheAirWithBackgroundTelemetry( void )
+    {
+        Simulator sim;
+        Nightlight controller(0x26B8259200LL);
+        Nightlight node(0x26B8259200LL);
+        PatternSender sender;
+        PatternReceiver receiver;
+        PatternStore patterns;
+        byte data[150];
+        byte event[EventMessage::LENGTH] = { 1, 0 };
+        int i, j;
+        for(i=0; i<150; i++) data[i] = i ^ 0x33;
+
+        controller._myAddressOffset = 1;
+        node._myAddressOffset = 2;
+        controller.setup();
+        node.setup();
+        patterns.load();
+        receiver.setStore(&patterns);
+        node.pushState(&receiver);
+        sim.add(&controller);
+        sim.add(&node);
+
+        sender.setPattern(2, 0x42, data, sizeof(data));
+        controller.pushState(&sender);
+
+        for(i=0; i<1000 && sender.status() == PATTERN_PENDING; i++) {
+            event[1] = i;
+            if(i % 50 == 0) {
+                for(j=0; j<SEND_QUEUE_SIZE + 2; j++) controller.sendMessage(0, MSG_EVENT, event, EventMessage::LENGTH);
+            }
+            sim.run(10);
+        }
+        TS_ASSERT_EQUALS( sender.status(), PATTERN_OK );
+        TS_ASSERT( matches(&patterns, 0x42, data, sizeof(data)) );
+    }
+};
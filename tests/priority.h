@@ -0,0 +1,149 @@
+#include <cxxtest/TestSuite.h>
+
+#include <Nightlight.h>
+#include <Simulator.h>
+
+class PriorityTestSuite : public CxxTest::TestSuite 
+{
+public:
+    void setUp( void )
+    {
+        stubMillis = 1000;
+        RF24::resetCounters();
+    }
+
+    void testMessagePriority( void )
+    {
+        TS_ASSERT_EQUALS( messagePriority(MSG_HELLO), PRIORITY_PRESENCE );
+        TS_ASSERT_EQUALS( messagePriority(MSG_DISAPPEAR), PRIORITY_PRESENCE );
+        TS_ASSERT_EQUALS( messagePriority(MSG_CONTROL_REQUEST), PRIORITY_CONTROL );
+        TS_ASSERT_EQUALS( messagePriority(MSG_CONTROL_STOP), PRIORITY_CONTROL );
+        TS_ASSERT_EQUALS( messagePriority(MSG_COMMAND_SEND), PRIORITY_COMMAND );
+        TS_ASSERT_EQUALS( messagePriority(MSG_COMMAND_END), PRIORITY_COMMAND );
+        TS_ASSERT_EQUALS( messagePriority(MSG_EVENT), PRIORITY_TELEMETRY );
+    }
+
+    void testPresenceDroppedOverBudget( void )
+    {
+        Nightlight n(12345);
+        n._myAddressOffset = 1;
+        n.setBudget(PRIORITY_PRESENCE, 100, 33);
+
+        // Each 2 byte HELLO costs 4 + 9 bytes of budget
+        byte hello[2] = { NODE_KIND_OPEN, 20 };
+        int i;
+        for(i=0; i<5; i++) n.sendMessage(0, MSG_HELLO, hello, 2);
+
+        TS_ASSERT_EQUALS( n.trafficStats(PRIORITY_PRESENCE)->sent, 2 );
+        TS_ASSERT_EQUALS( n.trafficStats(PRIORITY_PRESENCE)->dropped, 3 );
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_HELLO], 2 );
+
+        // A second later the budget is back
+        stubMillis += 1000;
+        n.sendMessage(0, MSG_HELLO, hello, 2);
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_HELLO], 3 );
+    }
+
+    void testCommandsPreemptBeacons( void )
+    {
+        Nightlight n(12345);
+        n._myAddressOffset = 1;
+        int i;
+
+        // A burst of commands to many nodes, well over the command budget
+        for(i=2; i<200; i++) n.sendMessage(i, MSG_COMMAND_SEND, 0, 0);
+        TS_ASSERT_EQUALS( n.trafficStats(PRIORITY_COMMAND)->sent, 198 );
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_COMMAND_SEND], 198 );
+
+        // ...which used up the airtime of background traffic
+        n.sendMessage(0, MSG_HELLO, 0, 0);
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_HELLO], 0 );
+        TS_ASSERT_EQUALS( n.trafficStats(PRIORITY_PRESENCE)->dropped, 1 );
+    }
+
+    void testControlDeferredUntilBudget( void )
+    {
+        Nightlight n(12345);
+        n._myAddressOffset = 1;
+        n.setBudget(PRIORITY_CONTROL, 120, 12);
+
+        n.sendMessage(2, MSG_CONTROL_REQUEST, 0, 0);
+        n.sendMessage(3, MSG_CONTROL_REQUEST, 0, 0);
+        n.sendMessage(4, MSG_CONTROL_REQUEST, 0, 0);
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_CONTROL_REQUEST], 1 );
+        TS_ASSERT_EQUALS( n.trafficStats(PRIORITY_CONTROL)->deferred, 2 );
+
+        stubMillis += 100;
+        n.loop();
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_CONTROL_REQUEST], 2 );
+
+        stubMillis += 100;
+        n.loop();
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_CONTROL_REQUEST], 3 );
+        TS_ASSERT_EQUALS( n.trafficStats(PRIORITY_CONTROL)->sent, 3 );
+        TS_ASSERT_EQUALS( n.trafficStats(PRIORITY_CONTROL)->dropped, 0 );
+    }
+
+    void testQueueFullDropsLowestPriority( void )
+    {
+        Nightlight n(12345);
+        n._myAddressOffset = 1;
+        n.setBudget(PRIORITY_CONTROL, 0, 0);
+        n.setBudget(PRIORITY_TELEMETRY, 0, 0);
+        int i;
+
+        for(i=0; i<SEND_QUEUE_SIZE; i++) n.sendMessage(0, MSG_EVENT, 0, 0);
+        TS_ASSERT_EQUALS( n.trafficStats(PRIORITY_TELEMETRY)->deferred, SEND_QUEUE_SIZE );
+
+        // Control traffic pushes telemetry out of the queue
+        n.sendMessage(2, MSG_CONTROL_STOP, 0, 0);
+        TS_ASSERT_EQUALS( n.trafficStats(PRIORITY_TELEMETRY)->dropped, 1 );
+        TS_ASSERT_EQUALS( n.trafficStats(PRIORITY_CONTROL)->deferred, 1 );
+
+        // ...but telemetry can't push out telemetry
+        n.sendMessage(0, MSG_EVENT, 0, 0);
+        TS_ASSERT_EQUALS( n.trafficStats(PRIORITY_TELEMETRY)->dropped, 2 );
+
+        // Control goes first once there's budget
+        n.setBudget(PRIORITY_CONTROL, 0, 12);
+        n.loop();
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_CONTROL_STOP], 1 );
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_EVENT], 0 );
+    }
+
+    void testClassesDontBlockEachOther( void )
+    {
+        Nightlight n(12345);
+        n._myAddressOffset = 1;
+        n.setBudget(PRIORITY_CONTROL, 0, 0);
+        n.setBudget(PRIORITY_TELEMETRY, 0, 0);
+        byte hello[2] = { NODE_KIND_OPEN, 20 };
+
+        n.sendMessage(2, MSG_CONTROL_STOP, 0, 0);
+        n.sendMessage(0, MSG_EVENT, 0, 0);
+        n.sendMessage(0, MSG_EVENT, 0, 0);
+        TS_ASSERT_EQUALS( n.trafficStats(PRIORITY_CONTROL)->deferred, 1 );
+        TS_ASSERT_EQUALS( n.trafficStats(PRIORITY_TELEMETRY)->deferred, 2 );
+
+        // Beacons go out on their own budget while other classes are queued
+        n.sendMessage(0, MSG_HELLO, hello, 2);
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_HELLO], 1 );
+        TS_ASSERT_EQUALS( n.trafficStats(PRIORITY_PRESENCE)->dropped, 0 );
+
+        // Telemetry isn't held up by the starved control frame ahead of it
+        n.setBudget(PRIORITY_TELEMETRY, 0, 12);
+        n.loop();
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_EVENT], 1 );
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_CONTROL_STOP], 0 );
+
+        // ...and a new telemetry frame waits behind the queued one
+        n.setBudget(PRIORITY_TELEMETRY, 0, 12);
+        n.sendMessage(0, MSG_EVENT, 0, 0);
+        TS_ASSERT_EQUALS( n.trafficStats(PRIORITY_TELEMETRY)->deferred, 3 );
+
+        n.setBudget(PRIORITY_CONTROL, 0, 12);
+        n.loop();
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_CONTROL_STOP], 1 );
+        TS_ASSERT_EQUALS( RF24::framesByType[MSG_EVENT], 2 );
+    }
+};
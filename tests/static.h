@@ -0,0 +1,204 @@
+#include <cxxtest/TestSuite.h>
+
+#include <NightlightStatic.h>
+#include <Simulator.h>
+
+const byte MSG_TEST = 0x30;
+
+/**
+ * Records the order in which states see events
+ */
+char staticLog[32];
+
+void staticLogEvent(char c) {
+  byte len = strlen(staticLog);
+  staticLog[len] = c;
+  staticLog[len+1] = 0;
+}
+
+class StaticBottom : public StaticState<StaticBottom> {
+  public:
+    template<class M> void start(M &me) { staticLogEvent('b'); }
+    template<class M> void onFinished(M &me) { staticLogEvent('f'); }
+    template<class M> bool receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength) {
+      staticLogEvent('B');
+      return true;
+    }
+};
+
+class StaticMiddle : public StaticState<StaticMiddle> {
+  public:
+    template<class M> void start(M &me) { staticLogEvent('m'); }
+    template<class M> bool receiveMessage(M &me, int sender, byte type, byte *data, byte dataLength) {
+      staticLogEvent('M');
+      return type == MSG_TEST;
+    }
+};
+
+class StaticTimer : public StaticState<StaticTimer> {
+  public:
+    template<class M> void start(M &me) {
+      staticLogEvent('t');
+      setTimeout(100);
+    }
+    template<class M> void onTimeout(M &me) {
+      staticLogEvent('T');
+      finish(me);
+    }
+};
+
+typedef StaticNightlight<StaticBottom, StaticMiddle, StaticTimer> TestMachine;
+
+typedef StaticNightlight<FriendList, OpenNode, ControlledNode, BlinkyLight> StaticNode;
+
+/**
+ * Takes a node under control on a working channel, sends it a command and lets
+ * the command finish, logging every change in the node's stack and channel
+ */
+template<class Node> void runControlScenario(Node &node, char *log, int logSize)
+{
+  Nightlight controller(0x26B8259100LL);
+  ControllerState controllerState;
+  controllerState.setWorkingChannel(90);
+  controller._myAddressOffset = 250;
+  controller.setup();
+  controller.pushState(&controllerState);
+
+  int numStates = -1, channel = -1;
+  log[0] = 0;
+  while(stubMillis < 40000) {
+    stubMillis++;
+    for(int pass = 0; pass < 4; pass++) {
+      controller.loop();
+      node.loop();
+    }
+
+    if(stubMillis == 30000) controllerState.receiveMessage(&controller, -1, MSG_COMMAND_SEND, 0, 0);
+
+    if(node.numStates() != numStates || node.channel() != channel) {
+      numStates = node.numStates();
+      channel = node.channel();
+      int len = strlen(log);
+      snprintf(log + len, logSize - len, "%lu:%d/%d ", stubMillis, numStates, channel);
+    }
+  }
+}
+
+class StaticTestSuite : public CxxTest::TestSuite 
+{
+public:
+    void setUp( void )
+    {
+        staticLog[0] = 0;
+        stubMillis = 0;
+    }
+
+    void testBubblesFromTopOfStack( void )
+    {
+        TestMachine n(12345);
+        n.link()._myAddressOffset = 7;
+
+        n.pushState<StaticBottom>();
+        n.pushState<StaticMiddle>();
+
+        n.sendMessage(7, MSG_TEST, 0, 0);
+        n.sendMessage(7, MSG_COMMAND_END, 0, 0);
+        TS_ASSERT_EQUALS( strcmp(staticLog, "bmMMB"), 0 );
+    }
+
+    void testRemoveAndChangeState( void )
+    {
+        TestMachine n(12345);
+        n.link()._myAddressOffset = 7;
+
+        n.pushState<StaticBottom>();
+        n.pushState<StaticMiddle>();
+        n.removeState<StaticBottom>();
+
+        // Removing a state that isn't on the stack does nothing
+        n.removeState<StaticBottom>();
+
+        n.sendMessage(7, MSG_COMMAND_END, 0, 0);
+        n.changeState<StaticMiddle, StaticBottom>();
+        n.sendMessage(7, MSG_TEST, 0, 0);
+        TS_ASSERT_EQUALS( strcmp(staticLog, "bmMbB"), 0 );
+    }
+
+    void testTimeoutAndFinish( void )
+    {
+        TestMachine n(12345);
+        n.notifyFinished<StaticTimer, StaticBottom>();
+        n.pushState<StaticTimer>();
+
+        n.loop();
+        stubMillis = 101;
+        n.loop();
+        n.loop();
+        TS_ASSERT_EQUALS( strcmp(staticLog, "tTf"), 0 );
+    }
+
+    void testNoVirtualOverhead( void )
+    {
+        TS_ASSERT_EQUALS( sizeof(StaticBottom), sizeof(unsigned long) );
+        TS_ASSERT( sizeof(StaticBottom) < sizeof(NightlightState) );
+    }
+
+    void testNoDynamicStack( void )
+    {
+        typedef StaticNightlight<StaticBottom> OneState;
+
+        // Beyond the link and its states, the stack costs less than Nightlight's pointers
+        TS_ASSERT_LESS_THAN( sizeof(OneState) - sizeof(NightlightLink) - sizeof(StaticBottom),
+                             sizeof(NightlightState *) * STATE_STACK_SIZE );
+        TS_ASSERT_LESS_THAN( sizeof(OneState), sizeof(Nightlight) );
+    }
+
+    void testStockStatesMatchNightlight( void )
+    {
+        char dynamicLog[256], nodeLog[256];
+        unsigned long dynamicFrames;
+
+        stubMillis = 1;
+        RF24::resetCounters();
+        srand(3);
+        SimulatedNode dynamicNode(1);
+        runControlScenario(dynamicNode.nightlight, dynamicLog, sizeof(dynamicLog));
+        dynamicFrames = RF24::framesBySender[1];
+
+        stubMillis = 1;
+        RF24::resetCounters();
+        srand(3);
+        StaticNode node(0x26B8259100LL);
+        node.state<OpenNode>().setState_controlled(&node.state<ControlledNode>());
+        node.state<OpenNode>().setFriendList(&node.state<FriendList>());
+        node.state<ControlledNode>().setCommand(&node.state<BlinkyLight>());
+        node.link()._myAddressOffset = 1;
+        node.setup();
+        node.pushState<FriendList>();
+        node.pushState<OpenNode>();
+        runControlScenario(node, nodeLog, sizeof(nodeLog));
+
+        // Controlled on the working channel, then the command runs and finishes
+        TS_ASSERT( strstr(dynamicLog, ":3/90 ") != 0 );
+        TS_ASSERT( strstr(dynamicLog, ":4/90 ") != 0 );
+        TS_ASSERT_EQUALS( dynamicLog[strlen(dynamicLog) - 5], '3' );
+
+        TS_ASSERT_EQUALS( strcmp(nodeLog, dynamicLog), 0 );
+        TS_ASSERT_EQUALS( RF24::framesBySender[1], dynamicFrames );
+        TS_ASSERT( RF24::framesBySender[1] > 0 );
+    }
+
+    void testFullStack( void )
+    {
+        TestMachine n(12345);
+        n.link()._myAddressOffset = 7;
+
+        for(int i=0; i<STATE_STACK_SIZE + 2; i++) n.pushState<StaticMiddle>();
+        n.pushState<StaticBottom>();
+
+        // The stack was full, so Bottom was never started and Middle is on top
+        n.sendMessage(7, MSG_TEST, 0, 0);
+        TS_ASSERT_EQUALS( staticLog[strlen(staticLog) - 1], 'M' );
+        TS_ASSERT( strchr(staticLog, 'b') == 0 );
+    }
+};
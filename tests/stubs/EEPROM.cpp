@@ -0,0 +1,40 @@
+#include <string.h>
+#include "EEPROM.h"
+
+EEPROMClass EEPROM;
+
+EEPROMClass::EEPROMClass() {
+  erase();
+}
+
+/**
+ * Erase every cell and reset the counters
+ */
+void EEPROMClass::erase() {
+  memset(cells, 0xFF, sizeof(cells));
+  memset(wear, 0, sizeof(wear));
+  reads = 0;
+  writes = 0;
+  writeMicros = 0;
+}
+
+uint8_t EEPROMClass::read(int address) {
+  reads++;
+  return cells[address % EEPROM_STUB_SIZE];
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+  address %= EEPROM_STUB_SIZE;
+  cells[address] = value;
+  wear[address]++;
+  writes++;
+  writeMicros += EEPROM_STUB_WRITE_MICROS;
+}
+
+void EEPROMClass::update(int address, uint8_t value) {
+  if(cells[address % EEPROM_STUB_SIZE] != value) write(address, value);
+}
+
+uint16_t EEPROMClass::length() {
+  return EEPROM_STUB_SIZE;
+}
@@ -0,0 +1,31 @@
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include <stdint.h>
+
+const unsigned int EEPROM_STUB_SIZE = 1024;          // As on an ATmega328
+const unsigned int EEPROM_STUB_WRITE_MICROS = 3300;  // Time to program one cell
+
+// Test stub for the Arduino EEPROM library
+// Cells start erased (0xFF). Every physical write is counted, per cell and in
+// total, along with the time it would take; update() only writes changed cells.
+class EEPROMClass {
+  public:
+    EEPROMClass();
+    uint8_t read(int address);
+    void write(int address, uint8_t value);
+    void update(int address, uint8_t value);
+    uint16_t length();
+
+    // Simulation
+    uint8_t cells[EEPROM_STUB_SIZE];
+    unsigned long wear[EEPROM_STUB_SIZE]; // Writes to each cell
+    unsigned long reads;
+    unsigned long writes;
+    unsigned long writeMicros;
+    void erase();
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -1,45 +1,210 @@
+#include <string.h>
+#include <stdlib.h>
 #include "RF24.h"
+#include "nRF24L01.h"
 
 SerialClass Serial;
 
-RF24::RF24(int, int) {}
+RF24 *RF24::_first = 0;
+unsigned long RF24::framesBySender[256];
+unsigned long RF24::framesByType[256];
+unsigned long RF24::framesSent;
+unsigned long RF24::bytesSent;
+unsigned long RF24::framesOverflowed;
+unsigned long RF24::framesCollided;
+bool RF24::simulateCollisions = false;
+unsigned long RF24::framesDelivered;
+unsigned long RF24::blockedMicros;
+byte RF24::linkLoss[256];
+unsigned long RF24::_lastFrameTime[128];
+byte RF24::_lastFrameSender[128];
+
+RF24::RF24(int, int) {
+  memset(_readingPipes, 0, sizeof(_readingPipes));
+  _writingPipe = 0;
+  _listening = false;
+  _channel = 76;
+  _retryDelay = 0;
+  _retryCount = 0;
+  _observeTx = 0;
+  _carrier = false;
+  for(int pipe = 0; pipe < 6; pipe++) _autoAck[pipe] = true;
+  _queueHead = 0;
+  _queueLength = 0;
+
+  _next = _first;
+  _first = this;
+}
+
+RF24::~RF24() {
+  RF24 **radio;
+  for(radio = &_first; *radio; radio = &(*radio)->_next) {
+    if(*radio == this) {
+      *radio = _next;
+      break;
+    }
+  }
+}
+
+void RF24::resetCounters() {
+  memset(framesBySender, 0, sizeof(framesBySender));
+  memset(framesByType, 0, sizeof(framesByType));
+  framesSent = 0;
+  bytesSent = 0;
+  framesOverflowed = 0;
+  framesCollided = 0;
+  framesDelivered = 0;
+  blockedMicros = 0;
+  memset(linkLoss, 0, sizeof(linkLoss));
+  memset(_lastFrameTime, 0, sizeof(_lastFrameTime));
+}
 
 void RF24::begin() {};
    
-bool RF24::available() { return false; };
+bool RF24::available() { return _queueLength > 0; };
 
-void RF24::setRetries(int, int) {};
+void RF24::setRetries(int delay, int count) {
+  _retryDelay = delay;
+  _retryCount = count;
+};
 
 void RF24::setPayloadSize(int) {};
 
 void RF24::enableDynamicPayloads() {};
 
-void RF24::setAutoAck (bool enable) {};
-
-void RF24::setAutoAck (uint8_t pipe, bool enable) {};
-
-uint8_t RF24::getDynamicPayloadSize() { return 1; };
-
-void RF24::openReadingPipe(int, int) {};
-
-void RF24::openWritingPipe(int) {};
-
-void RF24::startListening() {};
-
-void RF24::stopListening() {};
-
-bool RF24::write(byte *, int) { return true; };
-bool RF24::startWrite(byte *, int) { return true; };
+void RF24::setAutoAck (bool enable) {
+  for(int pipe = 0; pipe < 6; pipe++) _autoAck[pipe] = enable;
+};
+
+void RF24::setAutoAck (uint8_t pipe, bool enable) {
+  if(pipe < 6) _autoAck[pipe] = enable;
+};
+
+uint8_t RF24::getDynamicPayloadSize() {
+  return _queueLength ? _queueSizes[_queueHead] : 0;
+};
+
+void RF24::openReadingPipe(uint8_t pipe, uint64_t address) {
+  if(pipe < 6) _readingPipes[pipe] = address;
+};
+
+void RF24::openWritingPipe(uint64_t address) {
+  _writingPipe = address;
+};
+
+void RF24::startListening() { _listening = true; };
+
+void RF24::stopListening() { _listening = false; };
+
+/**
+ * Deliver to every listening radio on this channel with a reading pipe on the
+ * writing address. If none of them acknowledge, or the link loses the frame,
+ * retry as set by setRetries().
+ */
+bool RF24::write(byte *packet, int length) {
+  bool delivered = false;
+  bool acked = false;
+  RF24 *radio;
+
+  framesSent++;
+  bytesSent += length;
+  framesByType[packet[0]]++;
+  framesBySender[packet[1]]++;
+  _observeTx = 0;
+  _carrier = false;
+
+  if(simulateCollisions) {
+    if(_lastFrameTime[_channel] == millis() && _lastFrameSender[_channel] != packet[1]) {
+      framesCollided++;
+      _carrier = true;
+      blockedMicros += RF24_STUB_FRAME_MICROS;
+      return false;
+    }
+    _lastFrameTime[_channel] = millis();
+    _lastFrameSender[_channel] = packet[1];
+  }
+
+  byte loss = linkLoss[(byte)_writingPipe];
+  int attempt;
+  for(attempt = 0; attempt <= _retryCount; attempt++) {
+    blockedMicros += RF24_STUB_FRAME_MICROS;
+    if(attempt > 0) blockedMicros += 250 * (_retryDelay + 1);
+
+    if(loss && rand() % 100 < loss) continue;
+
+    // Only deliver the first attempt that gets through, however many times it's retried
+    bool reached = false;
+    for(radio = _first; radio; radio = radio->_next) {
+      if(radio == this || !radio->_listening || radio->_channel != _channel) continue;
+      for(int pipe = 0; pipe < 6; pipe++) {
+        if(radio->_readingPipes[pipe] && radio->_readingPipes[pipe] == _writingPipe) {
+          if(!delivered && radio->_receive(packet, length)) reached = true;
+          if(radio->_autoAck[pipe]) acked = true;
+          break;
+        }
+      }
+    }
+    if(reached) delivered = true;
+    if(acked) break;
+  }
+
+  _observeTx = (attempt > _retryCount ? _retryCount : attempt) & 0x0F;
+  if(delivered) framesDelivered++;
+  return acked;
+};
+
+bool RF24::startWrite(byte *packet, int length) { return write(packet, length); };
+
+bool RF24::_receive(byte *packet, int length) {
+  if(_queueLength >= RF24_STUB_QUEUE_SIZE) {
+    framesOverflowed++;
+    return false;
+  }
+  byte slot = (_queueHead + _queueLength) % RF24_STUB_QUEUE_SIZE;
+  memcpy(_queue[slot], packet, length);
+  _queueSizes[slot] = length;
+  _queueLength++;
+  return true;
+}
 
-bool RF24::read(byte *, int) { return false; };
+bool RF24::read(byte *packet, int length) {
+  if(!_queueLength) return false;
+  memcpy(packet, _queue[_queueHead], _queueSizes[_queueHead] < length ? _queueSizes[_queueHead] : length);
+  _queueHead = (_queueHead + 1) % RF24_STUB_QUEUE_SIZE;
+  _queueLength--;
+  return _queueLength == 0;
+};
     
 void RF24::setDataRate(int) { };
 void RF24::setPALevel(int) { };
+void RF24::setChannel(uint8_t channel) { _channel = channel & 127; };
+uint8_t RF24::getChannel() { return _channel; };
+bool RF24::testCarrier() { return _carrier; };
 
-void SerialClass::begin(int, int) {}
-bool SerialClass::available() { return false; }
+uint8_t RF24::read_register(uint8_t reg) {
+  return reg == OBSERVE_TX ? _observeTx : 0;
+};
 
-int SerialClass::readBytesUntil(byte, char *, int) { return 0; }
+void SerialClass::begin(int, int) {}
+const char *stubSerialInput = 0;
+
+bool SerialClass::available() { return stubSerialInput && *stubSerialInput; }
+
+/**
+ * Read from stubSerialInput, consuming the terminator
+ */
+int SerialClass::readBytesUntil(byte terminator, char *buffer, int length) {
+  int n = 0;
+  if(!stubSerialInput) return 0;
+
+  while(n < length && stubSerialInput[n] && stubSerialInput[n] != terminator) {
+    buffer[n] = stubSerialInput[n];
+    n++;
+  }
+  stubSerialInput += n;
+  if(*stubSerialInput == terminator) stubSerialInput++;
+  return n;
+}
 
 void SerialClass::write(const char *) {}
 
@@ -49,23 +214,29 @@ void SerialClass::println(const char *) {}
 void SerialClass::println(int) {}
 void SerialClass::print(const char *) {}
 void SerialClass::print(int) {}
+void SerialClass::print(int, int) {}
 
 void pinMode(int, int) {
 }
 
 void digitalWrite(int, bool) {
 }
+void analogWrite(int, int) {
+}
 void delay(int) {}
 
 int analogRead(int) {
 	return 0;
 }
-void randomSeed(int){
+void randomSeed(int seed){
+  srand(seed);
 }
-int random(int) {
-  return 0;
+int random(int max) {
+  return rand() % max;
 }
 
-int millis() {
-  return 0;
+unsigned long stubMillis = 0;
+
+unsigned long millis() {
+  return stubMillis;
 }
@@ -1,22 +1,33 @@
 // Arduino types
+#include <stdint.h>
 typedef unsigned char byte;
-typedef unsigned long long uint64_t;
-typedef unsigned char uint8_t;
 
 #ifndef RF24_h
 #define RF24_h
 
+const byte RF24_STUB_QUEUE_SIZE = 8;
+
+const unsigned int RF24_STUB_FRAME_MICROS = 130; // Time on air for one attempt, including the ACK
+
 // Test stub for RF24
+// All RF24 instances in the process share a simulated medium: a write is
+// delivered to every other listening radio on the same channel with a matching
+// reading pipe. The medium is lossless unless simulateCollisions is set, in
+// which case frames from different senders on the same channel in the same
+// msec collide and are lost. Unicast links can be made lossy with linkLoss;
+// writes are then retried as set by setRetries(), and the time spent is
+// added to blockedMicros.
 #define RF24_h
 class RF24 {
   public:
     RF24(int, int);
+    ~RF24();
     void begin();
     bool available();
     void setRetries(int, int);
     void setPayloadSize(int);
-    void openReadingPipe(int, int);
-    void openWritingPipe(int);
+    void openReadingPipe(uint8_t, uint64_t);
+    void openWritingPipe(uint64_t);
     void startListening();
     void stopListening();
     void enableDynamicPayloads();
@@ -24,13 +35,53 @@ class RF24 {
     void setAutoAck (uint8_t pipe, bool enable);   
     void setDataRate(int);
     void setPALevel(int);
+    void setChannel(uint8_t);
+    uint8_t getChannel();
+    bool testCarrier();
 
     uint8_t getDynamicPayloadSize();
     bool write(byte *, int);
     bool startWrite(byte *, int);
     bool read(byte *, int);
+
+    // Simulation counters, indexed by sender address (packet byte 1) and message type (byte 0)
+    static unsigned long framesBySender[256];
+    static unsigned long framesByType[256];
+    static unsigned long framesSent;
+    static unsigned long bytesSent;
+    static unsigned long framesOverflowed;
+    static unsigned long framesCollided;
+    static unsigned long framesDelivered;
+    static unsigned long blockedMicros;   // Time spent inside write(), including retries
+    static byte linkLoss[256];            // Percentage of attempts lost, by destination address (low byte of the pipe)
+    static bool simulateCollisions;
+    static void resetCounters();
+
+  protected:
+    uint8_t read_register(uint8_t reg);
     
   private:
+    uint64_t _readingPipes[6];
+    uint64_t _writingPipe;
+    bool _listening;
+    uint8_t _channel;
+    bool _autoAck[6];
+    int _retryDelay;
+    int _retryCount;
+    uint8_t _observeTx;
+    bool _carrier;
+
+    byte _queue[RF24_STUB_QUEUE_SIZE][32];
+    byte _queueSizes[RF24_STUB_QUEUE_SIZE];
+    byte _queueHead;
+    byte _queueLength;
+
+    RF24 *_next;
+    static RF24 *_first;
+    static unsigned long _lastFrameTime[128];
+    static byte _lastFrameSender[128];
+
+    bool _receive(byte *packet, int length);
 };
 
 
@@ -45,26 +96,36 @@ class SerialClass {
     void println(int);
     void print(const char *);
     void print(int);
+    void print(int, int);
 };
 
 extern SerialClass Serial;
+extern const char *stubSerialInput; // Lines for Serial to read, set by tests; 0 for none
 
 void pinMode(int, int);
 
 void digitalWrite(int, bool);
+void analogWrite(int, int);
 int analogRead(int);
 void delay(int);
 
 void randomSeed(int);
 int random(int);
 
-int millis();
+unsigned long millis();
+extern unsigned long stubMillis; // The time returned by millis(), set by tests
 
 const int OUTPUT = 1;
+const int HEX = 16;
 const int SERIAL_8N1 = 0;
 
+const int RF24_1MBPS = 0;
 const int RF24_2MBPS = 1;
-const int RF24_PA_HIGH = 1;
+const int RF24_250KBPS = 2;
+const int RF24_PA_MIN = 0;
+const int RF24_PA_LOW = 1;
+const int RF24_PA_HIGH = 2;
+const int RF24_PA_MAX = 3;
 
 #endif
 
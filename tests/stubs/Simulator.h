@@ -0,0 +1,75 @@
+#ifndef Simulator_h
+#define Simulator_h
+
+#include <Nightlight.h>
+
+const int SIMULATOR_MAX_NODES = 256;
+
+/**
+ * Runs a group of Nightlights against the simulated RF24 medium, one msec at a time
+ */
+class Simulator {
+  public:
+    Simulator() : _numNodes(0) {
+      stubMillis = 1;
+      RF24::resetCounters();
+    }
+
+    void add(Nightlight *node) {
+      _nodes[_numNodes++] = node;
+    }
+
+    void remove(Nightlight *node) {
+      for(int i = 0; i < _numNodes; i++) {
+        if(_nodes[i] == node) _nodes[i] = _nodes[--_numNodes];
+      }
+    }
+
+    /**
+     * Advance time, giving every node a few loops per msec to drain its radio
+     */
+    void run(unsigned long ms) {
+      unsigned long end = stubMillis + ms;
+      while(stubMillis < end) {
+        stubMillis++;
+        for(int pass = 0; pass < 4; pass++) {
+          for(int i = 0; i < _numNodes; i++) _nodes[i]->loop();
+        }
+      }
+    }
+
+  private:
+    Nightlight *_nodes[SIMULATOR_MAX_NODES];
+    int _numNodes;
+};
+
+/**
+ * A node that can be controlled, set up like the controllable_node example:
+ * a friend list, and an open node with a controlled state on top
+ */
+class SimulatedNode {
+  public:
+    Nightlight nightlight;
+    FriendList friendList;
+    OpenNode openNode;
+    ControlledNode controlledNode;
+    BlinkyLight blinky;
+
+    SimulatedNode(byte address) : nightlight(0x26B8259100LL) {
+      openNode.setState_controlled(&controlledNode);
+      openNode.setFriendList(&friendList);
+      controlledNode.setState_lostControl(&openNode);
+      controlledNode.setCommand(&blinky);
+
+      nightlight._myAddressOffset = address;
+      nightlight.setup();
+      nightlight.pushState(&friendList);
+      nightlight.pushState(&openNode);
+    }
+
+    bool controlled() {
+      return nightlight.numStates() > 2;
+    }
+};
+
+#endif
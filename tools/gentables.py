@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+"""
+Generate NightlightTables.h: the gamma-correction and easing lookup tables
+used by the animation engine. The tables are stored in PROGMEM so they cost
+flash rather than SRAM.
+
+Run with `make tables` after changing any of the curves below.
+"""
+
+import math
+import sys
+
+GAMMA = 2.8
+
+# Easing curves, indexed by EASE_* - 1 (EASE_LINEAR needs no table).
+# Each maps progress 0..1 to eased progress 0..1.
+EASINGS = [
+    ("EASE_IN", lambda t: t * t),
+    ("EASE_OUT", lambda t: 1 - (1 - t) * (1 - t)),
+    ("EASE_IN_OUT", lambda t: 0.5 - 0.5 * math.cos(math.pi * t)),
+]
+
+
+def table(fn):
+    return [min(255, int(round(fn(i / 255.0) * 255))) for i in range(256)]
+
+
+def rows(values, indent="  "):
+    lines = []
+    for i in range(0, len(values), 16):
+        lines.append(indent + ",".join("%3d" % v for v in values[i:i + 16]) + ",")
+    return "\n".join(lines)
+
+
+def main(out):
+    gamma = table(lambda t: t ** GAMMA)
+
+    text = []
+    text.append("// Generated by tools/gentables.py - do not edit by hand")
+    text.append("")
+    text.append("#ifndef NightlightTables_h")
+    text.append("#define NightlightTables_h")
+    text.append("")
+    text.append("// Gamma correction (%.1f) from linear brightness to PWM duty" % GAMMA)
+    text.append("const byte GAMMA_TABLE[256] PROGMEM = {")
+    text.append(rows(gamma))
+    text.append("};")
+    text.append("")
+    text.append("// Easing curves, mapping progress 0-255 to eased progress 0-255")
+    text.append("const byte EASING_TABLE[%d][256] PROGMEM = {" % len(EASINGS))
+    for name, fn in EASINGS:
+        text.append("  // %s" % name)
+        text.append("  {")
+        text.append(rows(table(fn), "    "))
+        text.append("  },")
+    text.append("};")
+    text.append("")
+    text.append("#endif")
+    text.append("")
+
+    with open(out, "w") as f:
+        f.write("\n".join(text))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1] if len(sys.argv) > 1 else "NightlightTables.h")